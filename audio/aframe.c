@@ -15,12 +15,16 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
+
 #include <libavutil/frame.h>
 #include <libavutil/mem.h>
 
 #include "config.h"
 
 #include "common/common.h"
+#include "common/stats.h"
+#include "osdep/threads.h"
 
 #include "chmap.h"
 #include "chmap_avchannel.h"
@@ -42,16 +46,60 @@ struct avframe_opaque {
     double speed;
 };
 
+// Buffers are recycled through process-wide pools shared by all
+// mp_aframe_pools, one per power-of-2 size class. This lets frames that get
+// freed anywhere in the chain (usually by the AO) be reused by any filter,
+// and keeps the buffers across filter chain rebuilds. Unused AVFrame structs
+// are cached for the same reason. All of this is freed when the last
+// mp_aframe_pool is destroyed.
+#define MIN_POOL_SIZE_LOG2 12
+#define NUM_SIZE_CLASSES 16
+#define MAX_CACHED_FRAMES 64
+
+static mp_static_mutex pool_mutex = MP_STATIC_MUTEX_INITIALIZER;
+static AVBufferPool *shared_pools[NUM_SIZE_CLASSES];
+static AVFrame *cached_frames[MAX_CACHED_FRAMES];
+static int num_cached_frames;
+static int num_pool_users;
+
+// For mp_aframe_pool_report_stats().
+static atomic_int_least64_t stat_buffer_allocs, stat_buffer_gets,
+                            stat_buffer_bytes, stat_frame_allocs;
+
+static AVFrame *get_av_frame(void)
+{
+    AVFrame *av_frame = NULL;
+    mp_mutex_lock(&pool_mutex);
+    if (num_cached_frames)
+        av_frame = cached_frames[--num_cached_frames];
+    mp_mutex_unlock(&pool_mutex);
+
+    if (!av_frame) {
+        atomic_fetch_add(&stat_frame_allocs, 1);
+        av_frame = av_frame_alloc();
+    }
+    return av_frame;
+}
+
 static void free_frame(void *ptr)
 {
     struct mp_aframe *frame = ptr;
+    av_frame_unref(frame->av_frame);
+
+    mp_mutex_lock(&pool_mutex);
+    if (num_pool_users && num_cached_frames < MAX_CACHED_FRAMES) {
+        cached_frames[num_cached_frames++] = frame->av_frame;
+        frame->av_frame = NULL;
+    }
+    mp_mutex_unlock(&pool_mutex);
+
     av_frame_free(&frame->av_frame);
 }
 
 struct mp_aframe *mp_aframe_create(void)
 {
     struct mp_aframe *frame = talloc_zero(NULL, struct mp_aframe);
-    frame->av_frame = av_frame_alloc();
+    frame->av_frame = get_av_frame();
     MP_HANDLE_OOM(frame->av_frame);
     talloc_set_destructor(frame, free_frame);
     mp_aframe_reset(frame);
@@ -620,19 +668,106 @@ int mp_aframe_approx_byte_size(struct mp_aframe *frame)
 }
 
 struct mp_aframe_pool {
+    // Only used for sizes beyond the largest shared pool.
     AVBufferPool *avpool;
     int element_size;
 };
 
-struct mp_aframe_pool *mp_aframe_pool_create(void *ta_parent)
+static void free_pool_buffer(void *opaque, uint8_t *data)
 {
-    return talloc_zero(ta_parent, struct mp_aframe_pool);
+    atomic_fetch_sub(&stat_buffer_bytes, (intptr_t)opaque);
+    av_free(data);
+}
+
+static AVBufferRef *alloc_pool_buffer(size_t size)
+{
+    uint8_t *data = av_malloc(size);
+    if (!data)
+        return NULL;
+    AVBufferRef *ref = av_buffer_create(data, size, free_pool_buffer,
+                                        (void *)(intptr_t)size, 0);
+    if (!ref) {
+        av_free(data);
+        return NULL;
+    }
+    atomic_fetch_add(&stat_buffer_allocs, 1);
+    atomic_fetch_add(&stat_buffer_bytes, size);
+    return ref;
 }
 
 static void mp_aframe_pool_destructor(void *p)
 {
     struct mp_aframe_pool *pool = p;
     av_buffer_pool_uninit(&pool->avpool);
+
+    mp_mutex_lock(&pool_mutex);
+    if (--num_pool_users == 0) {
+        // Buffers still in use keep their pool alive until they're freed.
+        for (int n = 0; n < NUM_SIZE_CLASSES; n++)
+            av_buffer_pool_uninit(&shared_pools[n]);
+        while (num_cached_frames)
+            av_frame_free(&cached_frames[--num_cached_frames]);
+    }
+    mp_mutex_unlock(&pool_mutex);
+}
+
+struct mp_aframe_pool *mp_aframe_pool_create(void *ta_parent)
+{
+    struct mp_aframe_pool *pool = talloc_zero(ta_parent, struct mp_aframe_pool);
+    talloc_set_destructor(pool, mp_aframe_pool_destructor);
+
+    mp_mutex_lock(&pool_mutex);
+    num_pool_users++;
+    mp_mutex_unlock(&pool_mutex);
+
+    return pool;
+}
+
+static AVBufferRef *pool_get_buffer(struct mp_aframe_pool *pool, int size)
+{
+    int size_class = 0;
+    while (size_class < NUM_SIZE_CLASSES &&
+           (1 << (MIN_POOL_SIZE_LOG2 + size_class)) < size)
+        size_class++;
+
+    if (size_class == NUM_SIZE_CLASSES) {
+        if (!pool->avpool || size > pool->element_size) {
+            size_t alloc = ta_calc_prealloc_elems(size);
+            if (alloc >= INT_MAX)
+                return NULL;
+            av_buffer_pool_uninit(&pool->avpool);
+            pool->element_size = alloc;
+            pool->avpool = av_buffer_pool_init(pool->element_size, alloc_pool_buffer);
+            if (!pool->avpool)
+                return NULL;
+        }
+        atomic_fetch_add(&stat_buffer_gets, 1);
+        return av_buffer_pool_get(pool->avpool);
+    }
+
+    mp_mutex_lock(&pool_mutex);
+    AVBufferPool **avpool = &shared_pools[size_class];
+    if (!*avpool) {
+        *avpool = av_buffer_pool_init(1 << (MIN_POOL_SIZE_LOG2 + size_class),
+                                      alloc_pool_buffer);
+    }
+    AVBufferRef *ref = *avpool ? av_buffer_pool_get(*avpool) : NULL;
+    mp_mutex_unlock(&pool_mutex);
+
+    atomic_fetch_add(&stat_buffer_gets, 1);
+    return ref;
+}
+
+// Report allocation counters of all frame pools. Except for the total size of
+// the pooled buffers, the values are cumulative, so during steady state
+// playback only the number of reused buffers should increase.
+void mp_aframe_pool_report_stats(struct stats_ctx *ctx)
+{
+    int64_t allocs = atomic_load(&stat_buffer_allocs);
+    stats_value(ctx, "buffer-allocs", allocs);
+    stats_value(ctx, "buffer-reuses", atomic_load(&stat_buffer_gets) - allocs);
+    stats_size_value(ctx, "buffer-bytes", atomic_load(&stat_buffer_bytes));
+    stats_value(ctx, "frame-allocs", atomic_load(&stat_frame_allocs));
 }
 
 // Like mp_aframe_allocate(), but use the pool to allocate data.
@@ -651,18 +786,6 @@ int mp_aframe_pool_allocate(struct mp_aframe_pool *pool, struct mp_aframe *frame
     if (size <= 0 || mp_aframe_is_allocated(frame))
         return -1;
 
-    if (!pool->avpool || size > pool->element_size) {
-        size_t alloc = ta_calc_prealloc_elems(size);
-        if (alloc >= INT_MAX)
-            return -1;
-        av_buffer_pool_uninit(&pool->avpool);
-        pool->element_size = alloc;
-        pool->avpool = av_buffer_pool_init(pool->element_size, NULL);
-        if (!pool->avpool)
-            return -1;
-        talloc_set_destructor(pool, mp_aframe_pool_destructor);
-    }
-
     // Yes, you have to do all this shit manually.
     // At least it's less stupid than av_frame_get_buffer(), which just wipes
     // the entire frame struct on error for no reason.
@@ -676,7 +799,7 @@ int mp_aframe_pool_allocate(struct mp_aframe_pool *pool, struct mp_aframe *frame
     } else {
         av_frame->extended_data = av_frame->data;
     }
-    av_frame->buf[0] = av_buffer_pool_get(pool->avpool);
+    av_frame->buf[0] = pool_get_buffer(pool, size);
     if (!av_frame->buf[0])
         return -1;
     av_frame->linesize[0] = samples * sstride;
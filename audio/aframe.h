@@ -73,3 +73,5 @@ struct mp_aframe_pool;
 struct mp_aframe_pool *mp_aframe_pool_create(void *ta_parent);
 int mp_aframe_pool_allocate(struct mp_aframe_pool *pool, struct mp_aframe *frame,
                             int samples);
+struct stats_ctx;
+void mp_aframe_pool_report_stats(struct stats_ctx *ctx);
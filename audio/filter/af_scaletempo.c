@@ -176,6 +176,68 @@ static void quadratic_interpolation_s16(
     }
 }
 
+#if HAVE_VECTOR
+
+typedef float v8sf __attribute__ ((vector_size (32), aligned (1)));
+typedef int32_t v8si __attribute__ ((vector_size (32), aligned (1)));
+
+// Widening the s16 samples for the vector code requires this builtin.
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_convertvector)
+#define HAVE_VECTOR_S16 1
+typedef int16_t v8hi __attribute__ ((vector_size (16), aligned (1)));
+#define LOAD_S16(p) __builtin_convertvector(*(const v8hi *)(p), v8si)
+#endif
+#endif
+
+#endif // HAVE_VECTOR
+
+#ifndef HAVE_VECTOR_S16
+#define HAVE_VECTOR_S16 0
+#endif
+
+// Taxicab distance between two blocks of interleaved samples.
+static float distance_float(const float *a, const float *b, int num_samples)
+{
+    float distance = 0;
+    int i = 0;
+#if HAVE_VECTOR
+    v8sf vsum[2] = {0};
+    for (; i + 16 <= num_samples; i += 16) {
+        v8sf d0 = *(const v8sf *)(a + i) - *(const v8sf *)(b + i);
+        v8sf d1 = *(const v8sf *)(a + i + 8) - *(const v8sf *)(b + i + 8);
+        // Clear the sign bit.
+        vsum[0] += (v8sf)((v8si)d0 & 0x7fffffff);
+        vsum[1] += (v8sf)((v8si)d1 & 0x7fffffff);
+    }
+    vsum[0] += vsum[1];
+    for (int n = 0; n < 8; n++)
+        distance += vsum[0][n];
+#endif
+    for (; i < num_samples; i++)
+        distance += fabsf(a[i] - b[i]);
+    return distance;
+}
+
+static int32_t distance_s16(const int16_t *a, const int16_t *b, int num_samples)
+{
+    int32_t distance = 0;
+    int i = 0;
+#if HAVE_VECTOR_S16
+    v8si vsum = {0};
+    for (; i + 8 <= num_samples; i += 8) {
+        v8si d = LOAD_S16(a + i) - LOAD_S16(b + i);
+        v8si sign = d >> 31;
+        vsum += (d ^ sign) - sign;
+    }
+    for (int n = 0; n < 8; n++)
+        distance += vsum[n];
+#endif
+    for (; i < num_samples; i++)
+        distance += abs((int32_t)a[i] - b[i]);
+    return distance;
+}
+
 static int best_overlap_offset_float(struct priv *s)
 {
     int num_channels = s->num_channels, frames_search = s->frames_search;
@@ -188,9 +250,8 @@ static int best_overlap_offset_float(struct priv *s)
     float best_distance = FLT_MAX;
     int best_offset_approx = 0;
     for (int offset = 0; offset < frames_search; offset += step_size) {
-        float distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += fabsf(target[i] - source[offset * num_channels + i]);
+        float distance = distance_float(target, source + offset * num_channels,
+                                        num_samples);
 
         int offset_approx = offset;
         history[0] = history[1];
@@ -213,9 +274,8 @@ static int best_overlap_offset_float(struct priv *s)
     int min_offset = MPMAX(0, best_offset_approx - step_size + 1);
     int max_offset = MPMIN(frames_search, best_offset_approx + step_size);
     for (int offset = min_offset; offset < max_offset; offset++) {
-        float distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += fabsf(target[i] - source[offset * num_channels + i]);
+        float distance = distance_float(target, source + offset * num_channels,
+                                        num_samples);
         if (distance < best_distance) {
             best_distance = distance;
             best_offset  = offset;
@@ -237,9 +297,8 @@ static int best_overlap_offset_s16(struct priv *s)
     int32_t best_distance = INT32_MAX;
     int best_offset_approx = 0;
     for (int offset = 0; offset < frames_search; offset += step_size) {
-        int32_t distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += abs((int32_t)target[i] - source[offset * num_channels + i]);
+        int32_t distance = distance_s16(target, source + offset * num_channels,
+                                        num_samples);
 
         int offset_approx = offset;
         history[0] = history[1];
@@ -262,9 +321,8 @@ static int best_overlap_offset_s16(struct priv *s)
     int min_offset = MPMAX(0, best_offset_approx - step_size + 1);
     int max_offset = MPMIN(frames_search, best_offset_approx + step_size);
     for (int offset = min_offset; offset < max_offset; offset++) {
-        int32_t distance = 0;
-        for (int i = 0; i < num_samples; i++)
-            distance += abs((int32_t)target[i] - source[offset * num_channels + i]);
+        int32_t distance = distance_s16(target, source + offset * num_channels,
+                                        num_samples);
         if (distance < best_distance) {
             best_distance = distance;
             best_offset  = offset;
@@ -281,10 +339,18 @@ static void output_overlap_float(struct priv *s, void *buf_out,
     float *pb   = s->table_blend;
     float *po   = s->buf_overlap;
     float *pin  = (float *)(s->buf_queue + bytes_off);
-    for (int i = 0; i < s->samples_overlap; i++) {
-        // the math is equal to *po * (1 - *pb) + *pin * *pb
-        float o = *po++;
-        *pout++ = o - *pb++ * (o - *pin++);
+    int i = 0;
+#if HAVE_VECTOR
+    for (; i + 8 <= s->samples_overlap; i += 8) {
+        v8sf o = *(const v8sf *)(po + i);
+        *(v8sf *)(pout + i) =
+            o - *(const v8sf *)(pb + i) * (o - *(const v8sf *)(pin + i));
+    }
+#endif
+    for (; i < s->samples_overlap; i++) {
+        // the math is equal to po[i] * (1 - pb[i]) + pin[i] * pb[i]
+        float o = po[i];
+        pout[i] = o - pb[i] * (o - pin[i]);
     }
 }
 
@@ -295,10 +361,18 @@ static void output_overlap_s16(struct priv *s, void *buf_out,
     int32_t *pb   = s->table_blend;
     int16_t *po   = s->buf_overlap;
     int16_t *pin  = (int16_t *)(s->buf_queue + bytes_off);
-    for (int i = 0; i < s->samples_overlap; i++) {
-        // the math is equal to *po * (1 - *pb) + *pin * *pb
-        int32_t o = *po++;
-        *pout++ = o - ((*pb++ *(o - *pin++)) >> 16);
+    int i = 0;
+#if HAVE_VECTOR_S16
+    for (; i + 8 <= s->samples_overlap; i += 8) {
+        v8si o = LOAD_S16(po + i);
+        v8si r = o - ((*(const v8si *)(pb + i) * (o - LOAD_S16(pin + i))) >> 16);
+        *(v8hi *)(pout + i) = __builtin_convertvector(r, v8hi);
+    }
+#endif
+    for (; i < s->samples_overlap; i++) {
+        // the math is equal to po[i] * (1 - pb[i]) + pin[i] * pb[i]
+        int32_t o = po[i];
+        pout[i] = o - ((pb[i] * (o - pin[i])) >> 16);
     }
 }
 
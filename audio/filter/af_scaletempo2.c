@@ -248,6 +248,11 @@ const struct mp_user_filter_entry af_scaletempo2 = {
                 OPT_FLOAT(min_playback_rate), M_RANGE(0, FLT_MAX)},
             {"max-speed",
                 OPT_FLOAT(max_playback_rate), M_RANGE(0, FLT_MAX)},
+            {"search",
+                OPT_CHOICE(search_mode,
+                    {"auto", SCALETEMPO2_SEARCH_AUTO},
+                    {"direct", SCALETEMPO2_SEARCH_DIRECT},
+                    {"fft", SCALETEMPO2_SEARCH_FFT})},
             {0}
         }
     },
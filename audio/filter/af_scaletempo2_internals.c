@@ -1,6 +1,9 @@
 #include <float.h>
 #include <math.h>
 
+#include <libavutil/mem.h>
+#include <libavutil/tx.h>
+
 #include "audio/chmap.h"
 #include "audio/filter/af_scaletempo2_internals.h"
 
@@ -31,11 +34,30 @@
 //
 // 6) Update:write
 
+// This is a compromise between complexity reduction and search accuracy. I
+// don't have a proof that down sample of order 5 is optimal.
+// One can compute a decimation factor that minimizes complexity given
+// the size of |search_block| and |target_block|. However, my experiments
+// show the rate of missing the optimal index is significant.
+// This value is chosen heuristically based on experiments.
+#define SEARCH_DECIMATION 5
+
 struct interval {
     int lo;
     int hi;
 };
 
+// Real FFTs used to compute the cross-correlation of |target_block| with
+// |search_block|, which yields the dot products of all candidate blocks.
+struct mp_scaletempo2_xcorr {
+    int size;
+    AVTXContext *fwd, *inv;
+    av_tx_fn fwd_fn, inv_fn;
+    float *buf;                     // |size| samples
+    AVComplexFloat *spec_search;    // |size| / 2 + 1 bins
+    AVComplexFloat *spec_target;    // |size| / 2 + 1 bins
+};
+
 static bool in_interval(int n, struct interval q)
 {
     return n >= q.lo && n <= q.hi;
@@ -191,6 +213,64 @@ static void multi_channel_dot_product(
 
 #endif // HAVE_VECTOR
 
+// Compute the dot products of |target_block| with every candidate block of
+// |search_block| at once, by correlating the two in the frequency domain. The
+// result is interleaved like the output of multi_channel_moving_block_energies.
+static void multi_channel_cross_correlation(
+    struct mp_scaletempo2_xcorr *xc,
+    float **target_block, int target_block_frames,
+    float **search_block, int search_block_frames,
+    int channels, float *dot_prod)
+{
+    int num_candidate_blocks = search_block_frames - (target_block_frames - 1);
+    int num_bins = xc->size / 2 + 1;
+    assert(search_block_frames <= xc->size);
+
+    for (int k = 0; k < channels; ++k) {
+        memcpy(xc->buf, search_block[k], search_block_frames * sizeof(float));
+        memset(xc->buf + search_block_frames, 0,
+               (xc->size - search_block_frames) * sizeof(float));
+        xc->fwd_fn(xc->fwd, xc->spec_search, xc->buf, sizeof(float));
+
+        memcpy(xc->buf, target_block[k], target_block_frames * sizeof(float));
+        memset(xc->buf + target_block_frames, 0,
+               (xc->size - target_block_frames) * sizeof(float));
+        xc->fwd_fn(xc->fwd, xc->spec_target, xc->buf, sizeof(float));
+
+        // Multiplying with the complex conjugate turns the convolution into a
+        // correlation. The FFT is large enough that the correlation does not
+        // wrap around for any candidate block.
+        for (int n = 0; n < num_bins; ++n) {
+            AVComplexFloat s = xc->spec_search[n];
+            AVComplexFloat t = xc->spec_target[n];
+            xc->spec_search[n] = (AVComplexFloat) {
+                .re = s.re * t.re + s.im * t.im,
+                .im = s.im * t.re - s.re * t.im,
+            };
+        }
+        xc->inv_fn(xc->inv, xc->buf, xc->spec_search, sizeof(AVComplexFloat));
+
+        for (int n = 0; n < num_candidate_blocks; ++n)
+            dot_prod[k + n * channels] = xc->buf[n];
+    }
+}
+
+// Return the dot products of |target_block| with the candidate block at |n|,
+// either from the precomputed |dot_prod_candidate_blocks| or by computing
+// them into |dot_prod|.
+static const float *candidate_dot_product(
+    float **target_block, int target_block_frames,
+    float **search_block, int n, int channels,
+    const float *dot_prod_candidate_blocks, float *dot_prod)
+{
+    if (dot_prod_candidate_blocks)
+        return &dot_prod_candidate_blocks[n * channels];
+
+    multi_channel_dot_product(target_block, 0, search_block, n, channels,
+        target_block_frames, dot_prod);
+    return dot_prod;
+}
+
 // Fit the curve f(x) = a * x^2 + b * x + c such that
 //   f(-1) = y[0]
 //   f(0) = y[1]
@@ -222,18 +302,19 @@ static int decimated_search(
     float **target_block, int target_block_frames,
     float **search_segment, int search_segment_frames,
     int channels,
-    const float *energy_target_block, const float *energy_candidate_blocks)
+    const float *energy_target_block, const float *energy_candidate_blocks,
+    const float *dot_prod_candidate_blocks)
 {
     int num_candidate_blocks = search_segment_frames - (target_block_frames - 1);
-    float dot_prod [MP_NUM_CHANNELS];
+    float dot_prod_buf [MP_NUM_CHANNELS];
+    const float *dot_prod;
     float similarity[3];  // Three elements for cubic interpolation.
 
     int n = 0;
-    multi_channel_dot_product(
-        target_block, 0,
-        search_segment, n,
-        channels,
-        target_block_frames, dot_prod);
+    dot_prod = candidate_dot_product(
+        target_block, target_block_frames,
+        search_segment, n, channels,
+        dot_prod_candidate_blocks, dot_prod_buf);
     similarity[0] = multi_channel_similarity_measure(
         dot_prod, energy_target_block,
         &energy_candidate_blocks[n * channels], channels);
@@ -247,11 +328,10 @@ static int decimated_search(
         return 0;
     }
 
-    multi_channel_dot_product(
-        target_block, 0,
-        search_segment, n,
-        channels,
-        target_block_frames, dot_prod);
+    dot_prod = candidate_dot_product(
+        target_block, target_block_frames,
+        search_segment, n, channels,
+        dot_prod_candidate_blocks, dot_prod_buf);
     similarity[1] = multi_channel_similarity_measure(
         dot_prod, energy_target_block,
         &energy_candidate_blocks[n * channels], channels);
@@ -264,11 +344,10 @@ static int decimated_search(
     }
 
     for (; n < num_candidate_blocks; n += decimation) {
-        multi_channel_dot_product(
-            target_block, 0,
-            search_segment, n,
-            channels,
-            target_block_frames, dot_prod);
+        dot_prod = candidate_dot_product(
+            target_block, target_block_frames,
+            search_segment, n, channels,
+            dot_prod_candidate_blocks, dot_prod_buf);
 
         similarity[2] = multi_channel_similarity_measure(
             dot_prod, energy_target_block,
@@ -316,10 +395,11 @@ static int full_search(
     float **search_block, int search_block_frames,
     int channels,
     const float* energy_target_block,
-    const float* energy_candidate_blocks)
+    const float* energy_candidate_blocks,
+    const float* dot_prod_candidate_blocks)
 {
     // int block_size = target_block->frames;
-    float dot_prod [sizeof(float) * MP_NUM_CHANNELS];
+    float dot_prod_buf [MP_NUM_CHANNELS];
 
     float best_similarity = -FLT_MAX;//FLT_MIN;
     int optimal_index = 0;
@@ -328,8 +408,10 @@ static int full_search(
         if (in_interval(n, exclude_interval)) {
             continue;
         }
-        multi_channel_dot_product(target_block, 0, search_block, n, channels,
-            target_block_frames, dot_prod);
+        const float *dot_prod = candidate_dot_product(
+            target_block, target_block_frames,
+            search_block, n, channels,
+            dot_prod_candidate_blocks, dot_prod_buf);
 
         float similarity = multi_channel_similarity_measure(
             dot_prod, energy_target_block,
@@ -347,22 +429,19 @@ static int full_search(
 // Find the index of the block, within |search_block|, that is most similar
 // to |target_block|. Obviously, the returned index is w.r.t. |search_block|.
 // |exclude_interval| is an interval that is excluded from the search.
+// If |xcorr| is set, the dot products of all candidate blocks are computed
+// upfront into |dot_prod_candidate_blocks|.
 static int compute_optimal_index(
     float **search_block, int search_block_frames,
     float **target_block, int target_block_frames,
     float *energy_candidate_blocks,
+    struct mp_scaletempo2_xcorr *xcorr,
+    float *dot_prod_candidate_blocks,
     int channels,
     struct interval exclude_interval)
 {
     int num_candidate_blocks = search_block_frames - (target_block_frames - 1);
-
-    // This is a compromise between complexity reduction and search accuracy. I
-    // don't have a proof that down sample of order 5 is optimal.
-    // One can compute a decimation factor that minimizes complexity given
-    // the size of |search_block| and |target_block|. However, my experiments
-    // show the rate of missing the optimal index is significant.
-    // This value is chosen heuristically based on experiments.
-    const int search_decimation = 5;
+    const int search_decimation = SEARCH_DECIMATION;
 
     float energy_target_block [MP_NUM_CHANNELS];
     // energy_candidate_blocks must have at least size
@@ -383,13 +462,23 @@ static int compute_optimal_index(
         channels,
         target_block_frames, energy_target_block);
 
+    if (xcorr) {
+        multi_channel_cross_correlation(xcorr,
+            target_block, target_block_frames,
+            search_block, search_block_frames,
+            channels, dot_prod_candidate_blocks);
+    } else {
+        dot_prod_candidate_blocks = NULL;
+    }
+
     int optimal_index = decimated_search(
         search_decimation, exclude_interval,
         target_block, target_block_frames,
         search_block, search_block_frames,
         channels,
         energy_target_block,
-        energy_candidate_blocks);
+        energy_candidate_blocks,
+        dot_prod_candidate_blocks);
 
     int lim_low = MPMAX(0, optimal_index - search_decimation);
     int lim_high = MPMIN(num_candidate_blocks - 1,
@@ -399,7 +488,8 @@ static int compute_optimal_index(
         target_block, target_block_frames,
         search_block, search_block_frames,
         channels,
-        energy_target_block, energy_candidate_blocks);
+        energy_target_block, energy_candidate_blocks,
+        dot_prod_candidate_blocks);
 }
 
 static void peek_buffer(struct mp_scaletempo2 *p,
@@ -548,14 +638,31 @@ static void peek_audio_with_zero_prepend(struct mp_scaletempo2 *p,
     peek_buffer(p, num_frames_to_read, read_offset_frames, write_offset, dest);
 }
 
-static void get_optimal_block(struct mp_scaletempo2 *p)
+int mp_scaletempo2_find_optimal_index(struct mp_scaletempo2 *p,
+                                      int last_optimal)
 {
-    int optimal_index = 0;
-
     // An interval around last optimal block which is excluded from the search.
     // This is to reduce the buzzy sound. The number 160 is rather arbitrary and
     // derived heuristically.
     const int exclude_interval_length_frames = 160;
+    struct interval exclude_iterval = {
+        .lo = last_optimal - exclude_interval_length_frames / 2,
+        .hi = last_optimal + exclude_interval_length_frames / 2
+    };
+
+    return compute_optimal_index(
+        p->search_block, p->search_block_size,
+        p->target_block, p->ola_window_size,
+        p->energy_candidate_blocks,
+        p->xcorr, p->dot_prod_candidate_blocks,
+        p->channels,
+        exclude_iterval);
+}
+
+static void get_optimal_block(struct mp_scaletempo2 *p)
+{
+    int optimal_index = 0;
+
     if (target_is_within_search_region(p)) {
         optimal_index = p->target_block_index;
         peek_audio_with_zero_prepend(p,
@@ -567,19 +674,10 @@ static void get_optimal_block(struct mp_scaletempo2 *p)
             p->search_block_index, p->search_block, p->search_block_size);
         int last_optimal = p->target_block_index
             - p->ola_hop_size - p->search_block_index;
-        struct interval exclude_iterval = {
-            .lo = last_optimal - exclude_interval_length_frames / 2,
-            .hi = last_optimal + exclude_interval_length_frames / 2
-        };
 
         // |optimal_index| is in frames and it is relative to the beginning of the
         // |search_block|.
-        optimal_index = compute_optimal_index(
-            p->search_block, p->search_block_size,
-            p->target_block, p->ola_window_size,
-            p->energy_candidate_blocks,
-            p->channels,
-            exclude_iterval);
+        optimal_index = mp_scaletempo2_find_optimal_index(p, last_optimal);
 
         // Translate |index| w.r.t. the beginning of |audio_buffer| and extract the
         // optimal block.
@@ -778,6 +876,70 @@ static void get_symmetric_hanning_window(int window_length, float* window)
         window[n] = 0.5f * (1.0f - cosf(n * scale));
 }
 
+static void destroy_xcorr(void *ptr)
+{
+    struct mp_scaletempo2_xcorr *xc = ptr;
+    av_tx_uninit(&xc->fwd);
+    av_tx_uninit(&xc->inv);
+    av_freep(&xc->buf);
+    av_freep(&xc->spec_search);
+    av_freep(&xc->spec_target);
+}
+
+// Rough number of multiply-adds per channel and iteration for computing the
+// dot products directly, and with FFTs of |fft_size|. The direct search
+// visits every |SEARCH_DECIMATION|th candidate, and then all candidates
+// around the best one.
+static bool use_fft_search(struct mp_scaletempo2 *p, int fft_size)
+{
+    switch (p->opts->search_mode) {
+    case SCALETEMPO2_SEARCH_DIRECT: return false;
+    case SCALETEMPO2_SEARCH_FFT:    return true;
+    }
+
+    double direct_cost = (p->num_candidate_blocks / (double)SEARCH_DECIMATION
+                          + 2 * SEARCH_DECIMATION + 1) * p->ola_window_size;
+    // 2 forward and 1 inverse transform.
+    double fft_cost = 3.0 * fft_size * log2(fft_size);
+    return fft_cost < direct_cost;
+}
+
+static void init_xcorr(struct mp_scaletempo2 *p)
+{
+    TA_FREEP(&p->xcorr);
+
+    int size = 1;
+    while (size < p->search_block_size)
+        size <<= 1;
+
+    if (!use_fft_search(p, size))
+        return;
+
+    struct mp_scaletempo2_xcorr *xc = talloc_zero(p, struct mp_scaletempo2_xcorr);
+    talloc_set_destructor(xc, destroy_xcorr);
+    xc->size = size;
+
+    // The inverse transform is not normalized.
+    float scale = 1.0f, inv_scale = 1.0f / size;
+    if (av_tx_init(&xc->fwd, &xc->fwd_fn, AV_TX_FLOAT_RDFT, 0, size, &scale, 0) < 0 ||
+        av_tx_init(&xc->inv, &xc->inv_fn, AV_TX_FLOAT_RDFT, 1, size, &inv_scale, 0) < 0)
+        goto fail;
+
+    xc->buf = av_malloc_array(size, sizeof(float));
+    xc->spec_search = av_malloc_array(size / 2 + 1, sizeof(AVComplexFloat));
+    xc->spec_target = av_malloc_array(size / 2 + 1, sizeof(AVComplexFloat));
+    if (!xc->buf || !xc->spec_search || !xc->spec_target)
+        goto fail;
+
+    MP_RESIZE_ARRAY(p, p->dot_prod_candidate_blocks,
+        p->channels * p->num_candidate_blocks);
+    p->xcorr = xc;
+    return;
+
+fail:
+    // Fall back to computing the dot products directly.
+    talloc_free(xc);
+}
 
 void mp_scaletempo2_init(struct mp_scaletempo2 *p, int channels, int rate)
 {
@@ -841,4 +1003,6 @@ void mp_scaletempo2_init(struct mp_scaletempo2 *p, int channels, int rate)
 
     MP_RESIZE_ARRAY(p, p->energy_candidate_blocks,
         p->channels * p->num_candidate_blocks);
+
+    init_xcorr(p);
 }
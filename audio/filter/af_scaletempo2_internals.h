@@ -31,6 +31,12 @@
 
 #include "common/common.h"
 
+enum {
+    SCALETEMPO2_SEARCH_AUTO,
+    SCALETEMPO2_SEARCH_DIRECT,
+    SCALETEMPO2_SEARCH_FFT,
+};
+
 struct mp_scaletempo2_opts {
     // Max/min supported playback rates for fast/slow audio. Audio outside of these
     // ranges are muted.
@@ -43,6 +49,9 @@ struct mp_scaletempo2_opts {
     // [-delta delta] around |output_index| * |playback_rate|. So the search
     // interval is 2 * delta.
     float wsola_search_interval_ms;
+    // How the dot products of the candidate blocks are computed. The FFT based
+    // cross-correlation is cheaper for large search intervals.
+    int search_mode;
 };
 
 struct mp_scaletempo2 {
@@ -119,6 +128,12 @@ struct mp_scaletempo2 {
     // for padding after the final packet.
     int input_buffer_added_silence;
     float *energy_candidate_blocks;
+    // Dot products of |target_block| with all candidate blocks, interleaved
+    // like |energy_candidate_blocks|. Only used if |xcorr| is set.
+    float *dot_prod_candidate_blocks;
+    // FFT state for computing |dot_prod_candidate_blocks|, or NULL if the dot
+    // products are computed directly while searching.
+    struct mp_scaletempo2_xcorr *xcorr;
 };
 
 void mp_scaletempo2_destroy(struct mp_scaletempo2 *p);
@@ -131,3 +146,8 @@ void mp_scaletempo2_set_final(struct mp_scaletempo2 *p);
 int mp_scaletempo2_fill_buffer(struct mp_scaletempo2 *p,
     float **dest, int dest_size, double playback_rate);
 bool mp_scaletempo2_frames_available(struct mp_scaletempo2 *p, double playback_rate);
+// Return the index of the block within |search_block| that is most similar to
+// |target_block|, skipping the blocks close to |last_optimal|. Both indexes
+// are relative to the beginning of |search_block|.
+int mp_scaletempo2_find_optimal_index(struct mp_scaletempo2 *p,
+                                      int last_optimal);
@@ -681,43 +681,87 @@ bool ao_need_conversion(struct ao_convert_fmt *fmt)
 // The LSB is always ignored.
 #if BYTE_ORDER == BIG_ENDIAN
 #define SHIFT24(x) ((3-(x))*8)
+// Same as writing bytes 3-1 of the sample followed by a 0 byte.
+#define PAD24(x) ((x) & 0xFFFFFF00u)
 #else
 #define SHIFT24(x) (((x)+1)*8)
+#define PAD24(x) ((x) >> 8)
 #endif
 
-static void convert_plane(int type, void *data, int num_samples)
+#if HAVE_VECTOR
+typedef uint32_t v8su __attribute__ ((vector_size (32), aligned (1)));
+#endif
+
+// dst can be the same as src.
+static void convert_plane(int type, void *dst, const void *src, int num_samples)
 {
+    const uint32_t *in = src;
+    int s = 0;
     switch (type) {
-    case 0:
-        break;
-    case 1: /* fall through */
-    case 2: {
-        int bytes = type == 1 ? 3 : 4;
-        for (int s = 0; s < num_samples; s++) {
-            uint32_t val = *((uint32_t *)data + s);
-            uint8_t *ptr = (uint8_t *)data + s * bytes;
+    case 1: {
+        uint8_t *out = dst;
+#if BYTE_ORDER == LITTLE_ENDIAN
+        // Pack 4 samples into 3 words at once. When converting in place, the
+        // output never overtakes the input.
+        for (; s + 4 <= num_samples; s += 4) {
+            uint32_t a = in[s], b = in[s + 1], c = in[s + 2], d = in[s + 3];
+            uint32_t w[3] = {
+                (a >> 8) | (b >> 8) << 24,
+                (b >> 16) | (c >> 8) << 16,
+                (c >> 24) | (d & 0xFFFFFF00u),
+            };
+            memcpy(out + s * 3, w, sizeof(w));
+        }
+#endif
+        for (; s < num_samples; s++) {
+            uint32_t val = in[s];
+            uint8_t *ptr = out + s * 3;
             ptr[0] = val >> SHIFT24(0);
             ptr[1] = val >> SHIFT24(1);
             ptr[2] = val >> SHIFT24(2);
-            if (type == 2)
-                ptr[3] = 0;
         }
         break;
     }
+    case 2: {
+        uint32_t *out = dst;
+#if HAVE_VECTOR
+        for (; s + 8 <= num_samples; s += 8)
+            *(v8su *)(out + s) = PAD24(*(const v8su *)(in + s));
+#endif
+        for (; s < num_samples; s++)
+            out[s] = PAD24(in[s]);
+        break;
+    }
     default:
         MP_ASSERT_UNREACHABLE();
     }
 }
 
-// data[n] contains the pointer to the first sample of the n-th plane, in the
-// format implied by fmt->src_fmt. src_fmt also controls whether the data is
-// all in one plane, or if there is a plane per channel.
-void ao_convert_inplace(struct ao_convert_fmt *fmt, void **data, int num_samples)
+// Like ao_convert_inplace(), but write the result to dst instead. dst can be
+// the same as src.
+void ao_convert(struct ao_convert_fmt *fmt, void **dst, void **src,
+                int num_samples)
 {
     int type = get_conv_type(fmt);
     bool planar = af_fmt_is_planar(fmt->src_fmt);
     int planes = planar ? fmt->channels : 1;
     int plane_samples = num_samples * (planar ? 1: fmt->channels);
-    for (int n = 0; n < planes; n++)
-        convert_plane(type, data[n], plane_samples);
+    for (int n = 0; n < planes; n++) {
+        if (type == 0) {
+            if (dst[n] != src[n]) {
+                memcpy(dst[n], src[n],
+                       plane_samples * af_fmt_to_bytes(fmt->src_fmt));
+            }
+        } else {
+            convert_plane(type, dst[n], src[n], plane_samples);
+        }
+    }
+}
+
+// data[n] contains the pointer to the first sample of the n-th plane, in the
+// format implied by fmt->src_fmt. src_fmt also controls whether the data is
+// all in one plane, or if there is a plane per channel.
+void ao_convert_inplace(struct ao_convert_fmt *fmt, void **data, int num_samples)
+{
+    ao_convert(fmt, data, data, num_samples);
 }
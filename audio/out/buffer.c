@@ -15,12 +15,20 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <inttypes.h>
 #include <math.h>
 #include <errno.h>
 #include <assert.h>
 
+#include "config.h"
+
+#if HAVE_POSIX
+#include <unistd.h>
+#include "osdep/poll_wrapper.h"
+#endif
+
 #include "ao.h"
 #include "internal.h"
 #include "audio/aframe.h"
@@ -32,9 +40,23 @@
 #include "filters/f_async_queue.h"
 #include "filters/filter_internal.h"
 
+#include "osdep/io.h"
 #include "osdep/timer.h"
 #include "osdep/threads.h"
 
+// Single-producer/single-consumer PCM ring buffer for pull AOs. The AO thread
+// moves data from the queue into it, and ao_read_data() reads from it in the
+// driver's audio callback without locking or allocating. The positions only
+// ever increase; the ring index is the position modulo size.
+struct pcm_ring {
+    int size;                       // capacity in samples
+    uint8_t *planes[MP_NUM_CHANNELS];
+    _Atomic uint64_t write_pos;     // advanced by the AO thread only
+    _Atomic uint64_t read_pos;      // advanced by ao_read_data() only
+    _Atomic uint64_t discard_pos;   // data before this was flushed by ao_reset()
+    atomic_bool eof;                // EOF follows the data at write_pos
+};
+
 struct buffer_state {
     // Buffer and AO
     mp_mutex lock;
@@ -50,6 +72,24 @@ struct buffer_state {
     // Immutable.
     struct mp_async_queue *queue;
 
+    // Pull AOs only. The ring is written with lock held, and read by the
+    // driver's thread without lock.
+    struct pcm_ring ring;
+    // Odd if ao_read_data() is allowed to play from the ring. Changed with lock
+    // held, except that ao_read_data() can increment it on underrun/EOF, in
+    // which case it also sets stopped_gen to the new value.
+    atomic_uint play_gen;
+    atomic_uint stopped_gen;
+
+    atomic_int_least64_t underruns;
+
+    // Set by ao_read_data() when it wrote to wakeup_pipe to request a refill,
+    // cleared by the AO thread before refilling. Avoids a write per callback.
+    atomic_bool ring_wakeup_sent;
+    // Pull AOs only, -1 if unavailable. Lets ao_read_data() wake up the AO
+    // thread without locking; the AO thread polls on it instead of pt_wakeup.
+    int wakeup_pipe[2];
+
     // --- protected by lock
 
     struct mp_filter *filter_root;
@@ -62,7 +102,7 @@ struct buffer_state {
     bool paused;                // logically paused
     bool hw_paused;             // driver->set_pause() was used successfully
 
-    int64_t end_time_ns;        // absolute output time of last played sample
+    _Atomic int64_t end_time_ns; // absolute output time of last played sample
     int64_t queued_time_ns;     // duration of samples that have been queued to
                                 // the device but have not been played.
                                 // This field is only set in ao_set_paused(),
@@ -85,6 +125,15 @@ struct buffer_state {
 
 static MP_THREAD_VOID ao_thread(void *arg);
 
+// Wake up the AO thread if it's polling wakeup_pipe. Never blocks or locks.
+static void wakeup_pipe_signal(struct buffer_state *p)
+{
+#if HAVE_POSIX
+    if (p->wakeup_pipe[1] >= 0)
+        (void)write(p->wakeup_pipe[1], &(char){0}, 1);
+#endif
+}
+
 void ao_wakeup(struct ao *ao)
 {
     struct buffer_state *p = ao->buffer_state;
@@ -92,6 +141,7 @@ void ao_wakeup(struct ao *ao)
     p->need_wakeup = true;
     mp_cond_broadcast(&p->pt_wakeup);
     mp_mutex_unlock(&p->pt_lock);
+    wakeup_pipe_signal(p);
 }
 
 // called locked
@@ -178,24 +228,192 @@ static int read_buffer(struct ao *ao, void **data, int samples, bool *eof,
     return pos;
 }
 
-static int ao_read_data_locked(struct ao *ao, void **data, int samples,
-                               int64_t out_time_ns, bool *eof, bool pad_silence)
+// Copy samples between the ring at position pos and data[] at offset.
+static void ring_copy(struct ao *ao, uint64_t pos, void **data, int offset,
+                      int samples, bool to_ring)
+{
+    struct pcm_ring *r = &ao->buffer_state->ring;
+    int start = pos % r->size;
+    int part = MPMIN(samples, r->size - start);
+    for (int n = 0; n < ao->num_planes; n++) {
+        char *rd = (char *)r->planes[n];
+        char *d = (char *)data[n] + offset * ao->sstride;
+        if (to_ring) {
+            memcpy(rd + start * ao->sstride, d, part * ao->sstride);
+            memcpy(rd, d + part * ao->sstride, (samples - part) * ao->sstride);
+        } else {
+            memcpy(d, rd + start * ao->sstride, part * ao->sstride);
+            memcpy(d + part * ao->sstride, rd, (samples - part) * ao->sstride);
+        }
+    }
+}
+
+// Position of the first sample that ao_read_data() will play next.
+static uint64_t ring_read_pos(struct pcm_ring *r)
+{
+    return MPMAX(atomic_load_explicit(&r->read_pos, memory_order_acquire),
+                 atomic_load(&r->discard_pos));
+}
+
+// Number of samples queued in the ring.
+static int ring_get_samples(struct pcm_ring *r)
+{
+    uint64_t wpos = atomic_load(&r->write_pos);
+    uint64_t rpos = ring_read_pos(r);
+    return wpos > rpos ? wpos - rpos : 0;
+}
+
+// called locked
+// Drop all data in the ring. ao_read_data() might still be copying the old
+// data while it gets overwritten, which at worst outputs parts of new audio
+// early.
+static void ring_flush(struct pcm_ring *r)
+{
+    atomic_store(&r->discard_pos, atomic_load(&r->write_pos));
+    atomic_store(&r->eof, false);
+}
+
+// called locked
+// Make ao_read_data() play or stop playing according to the current state.
+static void update_play_gen(struct ao *ao)
 {
     struct buffer_state *p = ao->buffer_state;
-    assert(!ao->driver->write);
+    if (ao->driver->write)
+        return;
 
-    int pos = read_buffer(ao, data, samples, eof, pad_silence);
+    bool active = p->playing && !p->paused;
+    unsigned int gen = atomic_load(&p->play_gen);
+    if ((gen & 1) != active)
+        atomic_store(&p->play_gen, gen + 1);
+}
 
-    if (pos > 0)
-        p->end_time_ns = out_time_ns;
+// called locked
+// Make handle_ring_stop() ignore stops that ao_read_data() already reported.
+// If ao_read_data() is not allowed to play (even play_gen), it can't change
+// play_gen concurrently, and skipping to the next even value also invalidates
+// a stop whose stopped_gen store is still in flight.
+static void discard_ring_stop(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
+    if (ao->driver->write)
+        return;
+
+    unsigned int gen = atomic_load(&p->play_gen);
+    if (!(gen & 1))
+        atomic_store(&p->play_gen, gen + 2);
+    atomic_store(&p->stopped_gen, 0);
+}
+
+// called locked
+// Apply a stop caused by underrun or EOF in ao_read_data(), unless the state
+// was changed again in the meantime.
+static void handle_ring_stop(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
 
-    if (pos < samples && p->playing && !p->paused) {
+    unsigned int gen = atomic_exchange(&p->stopped_gen, 0);
+    if (gen && gen == atomic_load(&p->play_gen) && p->playing && !p->paused) {
         p->playing = false;
         ao->wakeup_cb(ao->wakeup_ctx);
         // For ao_drain().
         mp_cond_broadcast(&p->wakeup);
     }
+}
+
+// called locked
+// Move data from the queue into the ring. Returns whether anything was done.
+static bool feed_ring(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
+    struct pcm_ring *r = &p->ring;
+    bool progress = false;
+
+    atomic_store(&p->ring_wakeup_sent, false);
+    handle_ring_stop(ao);
+
+    uint64_t wpos = atomic_load(&r->write_pos);
+    while (p->playing) {
+        int space = r->size - (int)(wpos - ring_read_pos(r));
+        if (space <= 0)
+            break;
+
+        if (!p->pending || !mp_aframe_get_size(p->pending)) {
+            TA_FREEP(&p->pending);
+            struct mp_frame frame = mp_pin_out_read(p->input->pins[0]);
+            if (!frame.type)
+                break;
+            if (frame.type != MP_FRAME_AUDIO) {
+                if (frame.type == MP_FRAME_EOF)
+                    atomic_store_explicit(&r->eof, true, memory_order_release);
+                mp_frame_unref(&frame);
+                continue;
+            }
+            p->pending = frame.data;
+        }
+
+        int copy = MPMIN(mp_aframe_get_size(p->pending), space);
+        ring_copy(ao, wpos, (void **)mp_aframe_get_data_ro(p->pending), 0,
+                  copy, true);
+        mp_aframe_skip_samples(p->pending, copy);
+        wpos += copy;
+        atomic_store_explicit(&r->eof, false, memory_order_relaxed);
+        atomic_store_explicit(&r->write_pos, wpos, memory_order_release);
+        progress = true;
+    }
+
+    return progress;
+}
 
+// Counterpart to feed_ring(), called from the driver's thread. Must not block.
+static int read_ring(struct ao *ao, void **data, int samples,
+                     int64_t out_time_ns, bool *eof, bool pad_silence)
+{
+    struct buffer_state *p = ao->buffer_state;
+    struct pcm_ring *r = &p->ring;
+    int pos = 0;
+    *eof = false;
+
+    unsigned int gen = atomic_load(&p->play_gen);
+    if (gen & 1) {
+        bool ring_eof = atomic_load_explicit(&r->eof, memory_order_acquire);
+        uint64_t wpos = atomic_load_explicit(&r->write_pos, memory_order_acquire);
+        uint64_t rpos = ring_read_pos(r);
+
+        pos = wpos > rpos ? MPMIN(wpos - rpos, samples) : 0;
+        ring_copy(ao, rpos, data, 0, pos, false);
+        atomic_store_explicit(&r->read_pos, rpos + pos, memory_order_release);
+
+        if (pos > 0)
+            atomic_store(&p->end_time_ns, out_time_ns);
+
+        // Stop playing; the AO thread does the rest with handle_ring_stop().
+        bool stopped = false;
+        if (pos < samples) {
+            *eof = ring_eof;
+            if (atomic_compare_exchange_strong(&p->play_gen, &gen, gen + 1)) {
+                if (!ring_eof)
+                    atomic_fetch_add(&p->underruns, 1);
+                atomic_store(&p->stopped_gen, gen + 1);
+                stopped = true;
+            }
+        }
+
+        // Request a refill once the ring is half empty.
+        if ((stopped || wpos - (rpos + pos) < r->size / 2) &&
+            !atomic_exchange(&p->ring_wakeup_sent, true))
+            wakeup_pipe_signal(p);
+    }
+
+    // pad with silence (underflow/paused/eof)
+    if (pad_silence) {
+        for (int n = 0; n < ao->num_planes; n++) {
+            af_fill_silence((char *)data[n] + pos * ao->sstride,
+                    (samples - pos) * ao->sstride,
+                    ao->format);
+        }
+    }
+
+    ao_post_process_data(ao, data, pos);
     return pos;
 }
 
@@ -207,15 +425,11 @@ static int ao_read_data_locked(struct ao *ao, void **data, int samples,
 // If this is called in paused mode, it will always return 0.
 // The caller should set out_time_ns to the expected delay until the last sample
 // reaches the speakers, in nanoseconds, using mp_time_ns() as reference.
+// This never locks or allocates, so it is safe to call from realtime threads.
+// The blocking parameter is ignored.
 int ao_read_data(struct ao *ao, void **data, int samples, int64_t out_time_ns, bool *eof, bool pad_silence, bool blocking)
 {
-    struct buffer_state *p = ao->buffer_state;
-
-    if (blocking) {
-        mp_mutex_lock(&p->lock);
-    } else if (mp_mutex_trylock(&p->lock)) {
-        return 0;
-    }
+    assert(!ao->driver->write);
 
     bool eof_buf;
     if (eof == NULL) {
@@ -223,11 +437,7 @@ int ao_read_data(struct ao *ao, void **data, int samples, int64_t out_time_ns, b
         eof = &eof_buf;
     }
 
-    int pos = ao_read_data_locked(ao, data, samples, out_time_ns, eof, pad_silence);
-
-    mp_mutex_unlock(&p->lock);
-
-    return pos;
+    return read_ring(ao, data, samples, out_time_ns, eof, pad_silence);
 }
 
 // Same as ao_read_data(), but convert data according to *fmt.
@@ -250,6 +460,13 @@ int ao_read_data_converted(struct ao *ao, struct ao_convert_fmt *fmt,
     int src_plane_size = plane_samples * af_fmt_to_bytes(fmt->src_fmt);
     int dst_plane_size = plane_samples * fmt->dst_bits / 8;
 
+    // If the samples don't shrink, convert in the caller's buffer directly.
+    if (dst_plane_size == src_plane_size) {
+        int res = ao_read_data(ao, data, samples, out_time_ns, NULL, true, true);
+        ao_convert_inplace(fmt, data, samples);
+        return res;
+    }
+
     int needed = src_plane_size * planes;
     if (needed > talloc_get_size(p->convert_buffer) || !p->convert_buffer) {
         talloc_free(p->convert_buffer);
@@ -261,9 +478,7 @@ int ao_read_data_converted(struct ao *ao, struct ao_convert_fmt *fmt,
 
     int res = ao_read_data(ao, ndata, samples, out_time_ns, NULL, true, true);
 
-    ao_convert_inplace(fmt, ndata, samples);
-    for (int n = 0; n < planes; n++)
-        memcpy(data[n], ndata[n], dst_plane_size);
+    ao_convert(fmt, data, ndata, samples);
 
     return res;
 }
@@ -315,6 +530,8 @@ double ao_get_delay(struct ao *ao)
     int64_t pending = mp_async_queue_get_samples(p->queue);
     if (p->pending)
         pending += mp_aframe_get_size(p->pending);
+    if (!ao->driver->write)
+        pending += ring_get_samples(&p->ring);
 
     mp_mutex_unlock(&p->lock);
     return driver_delay + pending / (double)ao->samplerate;
@@ -333,6 +550,8 @@ void ao_reset(struct ao *ao)
     mp_async_queue_reset(p->queue);
     mp_filter_reset(p->filter_root);
     mp_async_queue_resume_reading(p->queue);
+    if (!ao->driver->write)
+        ring_flush(&p->ring);
 
     if (!ao->stream_silence && ao->driver->reset) {
         if (ao->driver->write) {
@@ -349,6 +568,8 @@ void ao_reset(struct ao *ao)
     p->recover_pause = false;
     p->hw_paused = false;
     p->end_time_ns = 0;
+    update_play_gen(ao);
+    discard_ring_stop(ao);
 
     mp_mutex_unlock(&p->lock);
 
@@ -370,11 +591,19 @@ void ao_start(struct ao *ao)
 
     mp_mutex_lock(&p->lock);
 
+    // A pending stop from before must not cancel this start.
+    discard_ring_stop(ao);
     p->playing = true;
 
-    if (!ao->driver->write && !p->paused && !p->streaming) {
-        p->streaming = true;
-        do_start = true;
+    if (!ao->driver->write) {
+        // The driver might read data right away when starting.
+        feed_ring(ao);
+        update_play_gen(ao);
+
+        if (!p->paused && !p->streaming) {
+            p->streaming = true;
+            do_start = true;
+        }
     }
 
     mp_mutex_unlock(&p->lock);
@@ -435,6 +664,7 @@ void ao_set_paused(struct ao *ao, bool paused, bool eof)
         wakeup = true;
     }
     p->paused = paused;
+    update_play_gen(ao);
 
     mp_mutex_unlock(&p->lock);
 
@@ -520,6 +750,7 @@ void ao_uninit(struct ao *ao)
         p->terminate = true;
         mp_cond_broadcast(&p->pt_wakeup);
         mp_mutex_unlock(&p->pt_lock);
+        wakeup_pipe_signal(p);
 
         mp_thread_join(p->thread);
         p->thread_valid = false;
@@ -534,12 +765,21 @@ void ao_uninit(struct ao *ao)
         talloc_free(p->pending);
         talloc_free(p->convert_buffer);
         talloc_free(p->temp_buf);
+        for (int n = 0; n < MP_NUM_CHANNELS; n++)
+            talloc_free(p->ring.planes[n]);
 
         mp_cond_destroy(&p->wakeup);
         mp_mutex_destroy(&p->lock);
 
         mp_cond_destroy(&p->pt_wakeup);
         mp_mutex_destroy(&p->pt_lock);
+
+#if HAVE_POSIX
+        for (int n = 0; n < 2; n++) {
+            if (p->wakeup_pipe[n] >= 0)
+                close(p->wakeup_pipe[n]);
+        }
+#endif
     }
 
     talloc_free(ao);
@@ -548,6 +788,7 @@ void ao_uninit(struct ao *ao)
 void init_buffer_pre(struct ao *ao)
 {
     ao->buffer_state = talloc_zero(ao, struct buffer_state);
+    ao->buffer_state->wakeup_pipe[0] = ao->buffer_state->wakeup_pipe[1] = -1;
 }
 
 bool init_buffer_post(struct ao *ao)
@@ -577,21 +818,35 @@ bool init_buffer_post(struct ao *ao)
         .max_samples = ao->buffer,
         .max_bytes = INT64_MAX,
     };
+
+    if (!ao->driver->write) {
+        // The ring only needs to bridge the AO thread's wakeup latency. It's
+        // taken from the audio buffer, so the total latency stays the same.
+        p->ring.size = ao->device_buffer > 0 ? ao->device_buffer * 2
+                                             : ao->buffer / 2;
+        p->ring.size = MPCLAMP(p->ring.size, 1, ao->buffer);
+        cfg.max_samples = MPMAX(ao->buffer - p->ring.size, 1);
+        for (int n = 0; n < ao->num_planes; n++)
+            p->ring.planes[n] = talloc_size(NULL, p->ring.size * ao->sstride);
+#if HAVE_POSIX
+        if (mp_make_wakeup_pipe(p->wakeup_pipe) < 0)
+            p->wakeup_pipe[0] = p->wakeup_pipe[1] = -1;
+#endif
+    }
+
     mp_async_queue_set_config(p->queue, cfg);
 
-    if (ao->driver->write) {
-        mp_filter_graph_set_wakeup_cb(p->filter_root, wakeup_filters, ao);
+    mp_filter_graph_set_wakeup_cb(p->filter_root, wakeup_filters, ao);
 
-        p->thread_valid = true;
-        if (mp_thread_create(&p->thread, ao_thread, ao)) {
-            p->thread_valid = false;
-            return false;
-        }
-    } else {
-        if (ao->stream_silence) {
-            ao->driver->start(ao);
-            p->streaming = true;
-        }
+    p->thread_valid = true;
+    if (mp_thread_create(&p->thread, ao_thread, ao)) {
+        p->thread_valid = false;
+        return false;
+    }
+
+    if (!ao->driver->write && ao->stream_silence) {
+        ao->driver->start(ao);
+        p->streaming = true;
     }
 
     if (ao->stream_silence) {
@@ -635,8 +890,11 @@ static bool ao_play_data(struct ao *ao)
     struct mp_pcm_state state;
     get_dev_state(ao, &state);
 
-    if (p->streaming && !state.playing && !ao->untimed)
+    if (p->streaming && !state.playing && !ao->untimed) {
+        if (!p->got_eof)
+            atomic_fetch_add(&p->underruns, 1);
         goto eof;
+    }
 
     void **planes = NULL;
     int space = state.free_samples;
@@ -721,17 +979,27 @@ static MP_THREAD_VOID ao_thread(void *arg)
         mp_mutex_lock(&p->lock);
 
         bool retry = false;
-        if (!ao->driver->initially_blocked || p->initial_unblocked)
-            retry = ao_play_data(ao);
-
-        // Wait until the device wants us to write more data to it.
-        // Fallback to guessing.
         int64_t timeout = INT64_MAX;
-        if (p->streaming && !retry && (!p->paused || ao->stream_silence)) {
-            // Wake up again if half of the audio buffer has been played.
-            // Since audio could play at a faster or slower pace, wake up twice
-            // as often as ideally needed.
-            timeout = MP_TIME_S_TO_NS(ao->device_buffer / (double)ao->samplerate * 0.25);
+        if (ao->driver->write) {
+            if (!ao->driver->initially_blocked || p->initial_unblocked)
+                retry = ao_play_data(ao);
+
+            // Wait until the device wants us to write more data to it.
+            // Fallback to guessing.
+            if (p->streaming && !retry && (!p->paused || ao->stream_silence)) {
+                // Wake up again if half of the audio buffer has been played.
+                // Since audio could play at a faster or slower pace, wake up twice
+                // as often as ideally needed.
+                timeout = MP_TIME_S_TO_NS(ao->device_buffer / (double)ao->samplerate * 0.25);
+            }
+        } else {
+            feed_ring(ao);
+
+            // Without wakeup_pipe, ao_read_data() can't wake us up. Poll often
+            // enough to keep the ring filled, and to notice when it stopped
+            // playing.
+            if (p->wakeup_pipe[0] < 0 && p->playing && !p->paused)
+                timeout = MP_TIME_S_TO_NS(p->ring.size / (double)ao->samplerate * 0.25);
         }
 
         mp_mutex_unlock(&p->lock);
@@ -743,6 +1011,17 @@ static MP_THREAD_VOID ao_thread(void *arg)
         }
         if (!p->need_wakeup && !retry) {
             MP_STATS(ao, "start audio wait");
+#if HAVE_POSIX
+            if (p->wakeup_pipe[0] >= 0) {
+                // ao_wakeup() writes to the pipe after setting need_wakeup,
+                // so nothing is lost by unlocking first.
+                mp_mutex_unlock(&p->pt_lock);
+                struct pollfd fd = { .fd = p->wakeup_pipe[0], .events = POLLIN };
+                mp_poll(&fd, 1, -1);
+                mp_flush_wakeup_pipe(p->wakeup_pipe[0]);
+                mp_mutex_lock(&p->pt_lock);
+            } else
+#endif
             mp_cond_timedwait(&p->pt_wakeup, &p->pt_lock, timeout);
             MP_STATS(ao, "end audio wait");
         }
@@ -752,6 +1031,13 @@ static MP_THREAD_VOID ao_thread(void *arg)
     MP_THREAD_RETURN();
 }
 
+// Number of times the device ran out of data while playing, excluding EOF.
+int64_t ao_get_underruns(struct ao *ao)
+{
+    struct buffer_state *p = ao->buffer_state;
+    return atomic_load(&p->underruns);
+}
+
 void ao_unblock(struct ao *ao)
 {
     if (ao->driver->write) {
@@ -120,7 +120,8 @@ struct mp_pcm_state {
  *     audio API start calling the audio callback. Your audio callback should
  *     in turn call ao_read_data() to get audio data. Most functions are
  *     optional and will be emulated if missing (e.g. pausing is emulated as
- *     silence).
+ *     silence). ao_read_data() reads from a preallocated ring buffer without
+ *     locking, so it can be called from realtime threads.
  *     Also, the following optional callbacks can be provided:
  *          reset       (stops the audio callback, start() restarts it)
  */
@@ -228,6 +229,8 @@ struct ao_convert_fmt {
 bool ao_can_convert_inplace(struct ao_convert_fmt *fmt);
 bool ao_need_conversion(struct ao_convert_fmt *fmt);
 void ao_convert_inplace(struct ao_convert_fmt *fmt, void **data, int num_samples);
+void ao_convert(struct ao_convert_fmt *fmt, void **dst, void **src,
+                int num_samples);
 
 void ao_wakeup(struct ao *ao);
 
@@ -21,6 +21,15 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <libavutil/md5.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
 #include "cache.h"
 #include "common/msg.h"
 #include "common/av_common.h"
@@ -30,10 +39,13 @@
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "osdep/io.h"
+#include "osdep/threads.h"
 
 struct demux_cache_opts {
     char *cache_dir;
     int unlink_files;
+    bool persistent;
+    bool use_mmap;
 };
 
 #define OPT_BASE_STRUCT struct demux_cache_opts
@@ -44,6 +56,8 @@ const struct m_sub_options demux_cache_conf = {
         {"demuxer-cache-unlink-files", OPT_CHOICE(unlink_files,
             {"immediate", 2}, {"whendone", 1}, {"no", 0}),
         },
+        {"demuxer-cache-persistent", OPT_BOOL(persistent)},
+        {"demuxer-cache-mmap", OPT_BOOL(use_mmap)},
         {0}
     },
     .size = sizeof(struct demux_cache_opts),
@@ -56,12 +70,67 @@ const struct m_sub_options demux_cache_conf = {
 struct demux_cache {
     struct mp_log *log;
     struct demux_cache_opts *opts;
+    struct demux_packet_pool *packet_pool;
 
     char *filename;
+    char *index_filename;   // only set for persistent caches
     bool need_unlink;
     int fd;
     int64_t file_pos;
-    uint64_t file_size;
+    uint64_t file_size;     // including data not written yet
+
+    // The lock protects the fields below. Packet data is appended to batches,
+    // which are written by the writer thread (or synchronously if there is
+    // none). All other fields are accessed by the demuxer only.
+    mp_mutex lock;
+    mp_cond wakeup;
+    mp_thread writer;
+    bool writer_running;
+    bool writer_terminate;
+    bool write_error;
+    // Data not yet written to the file, sorted by file position. Only the
+    // last entry can be unsealed (still being appended to).
+    struct write_batch **batches;
+    int num_batches;
+    uint64_t flushed_size;  // file size without batches
+
+    // Read-only mapping of the first map_size bytes of the file, or NULL.
+    // Packets returned by demux_cache_read() may reference it.
+    AVBufferRef *map;
+    uint64_t map_size;
+};
+
+// Don't remap the file to make newly appended packets accessible, unless it
+// has grown at least by this amount. Reading such packets falls back to
+// read() instead.
+#define MAP_GROW_MIN (16 * 1024 * 1024)
+
+// Packets are collected into batches of this size before they are written.
+#define WRITE_BATCH_SIZE (4 * 1024 * 1024)
+// If this many sealed batches are waiting to be written, demux_cache_write()
+// refuses new packets, so the caller keeps them in memory.
+#define MAX_PENDING_BATCHES 8
+
+struct write_batch {
+    uint64_t pos;           // file position of data.start
+    bstr data;
+    bool sealed;            // no more data is appended
+};
+
+// Every packet payload is followed by this many zero bytes in the file, so
+// that the mapped data can be used as padded packet buffer.
+static const uint8_t zero_padding[AV_INPUT_BUFFER_PADDING_SIZE];
+
+// Header at the start of a persistent cache file, followed by key_len bytes
+// of the key the file was created for.
+#define PERSIST_MAGIC "mpvdcach"
+#define PERSIST_VERSION 2
+
+struct persist_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t lavc_version;
+    uint32_t key_len;
 };
 
 struct pkt_header {
@@ -75,10 +144,28 @@ struct sd_header {
     uint32_t len;
 };
 
+static void flush_batches(struct demux_cache *cache);
+
 static void cache_destroy(void *p)
 {
     struct demux_cache *cache = p;
 
+    mp_mutex_lock(&cache->lock);
+    flush_batches(cache);
+    if (cache->writer_running) {
+        cache->writer_terminate = true;
+        mp_cond_broadcast(&cache->wakeup);
+    }
+    mp_mutex_unlock(&cache->lock);
+
+    if (cache->writer_running)
+        mp_thread_join(cache->writer);
+
+    mp_mutex_destroy(&cache->lock);
+    mp_cond_destroy(&cache->wakeup);
+
+    av_buffer_unref(&cache->map);
+
     if (cache->fd >= 0)
         close(cache->fd);
 
@@ -88,55 +175,6 @@ static void cache_destroy(void *p)
     }
 }
 
-// Create a cache. This also initializes the cache file from the options. The
-// log parameter must stay valid until demux_cache is destroyed.
-// Free with talloc_free().
-struct demux_cache *demux_cache_create(struct mpv_global *global,
-                                       struct mp_log *log)
-{
-    struct demux_cache *cache = talloc_zero(NULL, struct demux_cache);
-    talloc_set_destructor(cache, cache_destroy);
-    cache->opts = mp_get_config_group(cache, global, &demux_cache_conf);
-    cache->log = log;
-    cache->fd = -1;
-
-    char *cache_dir = cache->opts->cache_dir;
-    if (cache_dir && cache_dir[0]) {
-        cache_dir = mp_get_user_path(NULL, global, cache_dir);
-    } else {
-        cache_dir = mp_find_user_file(NULL, global, "cache", "");
-    }
-
-    if (!cache_dir || !cache_dir[0])
-        goto fail;
-
-    mp_mkdirp(cache_dir);
-    cache->filename = mp_path_join(cache, cache_dir, "mpv-cache-XXXXXX.dat");
-    cache->fd = mp_mkostemps(cache->filename, 4, O_CLOEXEC);
-    if (cache->fd < 0) {
-        MP_ERR(cache, "Failed to create cache temporary file.\n");
-        goto fail;
-    }
-    cache->need_unlink = true;
-    if (cache->opts->unlink_files >= 2) {
-        if (unlink(cache->filename)) {
-            MP_ERR(cache, "Failed to unlink cache temporary file after creation.\n");
-        } else {
-            cache->need_unlink = false;
-        }
-    }
-
-    return cache;
-fail:
-    talloc_free(cache);
-    return NULL;
-}
-
-uint64_t demux_cache_get_size(struct demux_cache *cache)
-{
-    return cache->file_size;
-}
-
 static bool do_seek(struct demux_cache *cache, uint64_t pos)
 {
     if (cache->file_pos == pos)
@@ -197,9 +235,332 @@ static bool read_raw(struct demux_cache *cache, void *ptr, size_t len)
     return true;
 }
 
+// Write the batch to the file. Does not access any fields protected by the
+// lock, and can be called unlocked from the writer thread.
+static bool write_batch(struct demux_cache *cache, struct write_batch *batch)
+{
+    uint64_t pos = batch->pos;
+    unsigned char *ptr = batch->data.start;
+    size_t len = batch->data.len;
+
+    while (len) {
+#if HAVE_POSIX
+        ssize_t res = pwrite(cache->fd, ptr, len, pos);
+#else
+        // (Only used without writer thread, so this can't race with reads.)
+        ssize_t res = -1;
+        cache->file_pos = -1;
+        if (lseek(cache->fd, pos, SEEK_SET) != (off_t)-1)
+            res = write(cache->fd, ptr, len);
+#endif
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            MP_ERR(cache, "Failed to write to cache file: %s\n",
+                   res < 0 ? mp_strerror(errno) : "no space");
+            return false;
+        }
+        ptr += res;
+        pos += res;
+        len -= res;
+    }
+
+    return true;
+}
+
+// Called locked after the first batch was written.
+static void finish_batch(struct demux_cache *cache, bool ok)
+{
+    if (ok) {
+        struct write_batch *batch = cache->batches[0];
+        cache->flushed_size = batch->pos + batch->data.len;
+        MP_TARRAY_REMOVE_AT(cache->batches, cache->num_batches, 0);
+        talloc_free(batch);
+    } else {
+        // Keep the batches, so packets in them can still be read.
+        cache->write_error = true;
+    }
+    mp_cond_broadcast(&cache->wakeup);
+}
+
+static MP_THREAD_VOID writer_thread(void *p)
+{
+    struct demux_cache *cache = p;
+    mp_thread_set_name("demux/cache");
+
+    mp_mutex_lock(&cache->lock);
+    while (1) {
+        struct write_batch *batch =
+            cache->num_batches ? cache->batches[0] : NULL;
+        if (batch && batch->sealed && !cache->write_error) {
+            mp_mutex_unlock(&cache->lock);
+            bool ok = write_batch(cache, batch);
+            mp_mutex_lock(&cache->lock);
+            finish_batch(cache, ok);
+            continue;
+        }
+        if (cache->writer_terminate)
+            break;
+        mp_cond_wait(&cache->wakeup, &cache->lock);
+    }
+    mp_mutex_unlock(&cache->lock);
+
+    MP_THREAD_RETURN();
+}
+
+// Called locked. Hand the batch to the writer. Without writer thread, write it
+// immediately.
+static void submit_batch(struct demux_cache *cache, struct write_batch *batch)
+{
+    batch->sealed = true;
+
+    if (!cache->writer_running) {
+        while (cache->num_batches && !cache->write_error)
+            finish_batch(cache, write_batch(cache, cache->batches[0]));
+        return;
+    }
+
+    mp_cond_broadcast(&cache->wakeup);
+}
+
+// Called locked. Write all pending data and wait until it's done.
+static void flush_batches(struct demux_cache *cache)
+{
+    if (!cache->num_batches)
+        return;
+
+    submit_batch(cache, cache->batches[cache->num_batches - 1]);
+    while (cache->num_batches && !cache->write_error)
+        mp_cond_wait(&cache->wakeup, &cache->lock);
+}
+
+static bool read_at(int fd, uint64_t pos, void *ptr, size_t len)
+{
+    if (lseek(fd, pos, SEEK_SET) == (off_t)-1)
+        return false;
+    return read(fd, ptr, len) == len;
+}
+
+// Open (or create) the cache file for the given key. If the file exists and
+// was written for the same key by a compatible libavcodec version, the
+// existing contents are kept, and new packets are appended to it.
+static bool open_persistent(struct demux_cache *cache, const char *cache_dir,
+                            const char *key)
+{
+    uint8_t md5[16];
+    av_md5_sum(md5, key, strlen(key));
+    char *name = talloc_strdup(NULL, "mpv-cache-");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", md5[i]);
+    cache->filename = mp_path_join(cache, cache_dir,
+                                   talloc_asprintf(name, "%s.dat", name));
+    cache->index_filename = mp_path_join(cache, cache_dir,
+                                         talloc_asprintf(name, "%s.idx", name));
+    talloc_free(name);
+
+    cache->fd = open(cache->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (cache->fd < 0)
+        return false;
+
+#if HAVE_POSIX
+    // Appending to the same file from multiple instances would corrupt it.
+    if (flock(cache->fd, LOCK_EX | LOCK_NB)) {
+        MP_VERBOSE(cache, "Persistent cache file is in use.\n");
+        goto fail;
+    }
+#endif
+
+    size_t key_len = strlen(key);
+    struct persist_header hd;
+    char *old_key = talloc_size(NULL, key_len);
+    bool valid = read_at(cache->fd, 0, &hd, sizeof(hd)) &&
+                 memcmp(hd.magic, PERSIST_MAGIC, sizeof(hd.magic)) == 0 &&
+                 hd.version == PERSIST_VERSION &&
+                 hd.lavc_version == avcodec_version() &&
+                 hd.key_len == key_len &&
+                 read_at(cache->fd, sizeof(hd), old_key, key_len) &&
+                 memcmp(old_key, key, key_len) == 0;
+    talloc_free(old_key);
+
+    struct stat st;
+    if (valid && fstat(cache->fd, &st) == 0) {
+        cache->file_size = st.st_size;
+        cache->file_pos = -1;
+        MP_VERBOSE(cache, "Reusing persistent cache file %s (%"PRIu64" bytes).\n",
+                   cache->filename, cache->file_size);
+        return true;
+    }
+
+    // Start over. The old index refers to data that is being thrown away.
+    unlink(cache->index_filename);
+    if (ftruncate(cache->fd, 0))
+        goto fail;
+    cache->file_pos = lseek(cache->fd, 0, SEEK_SET);
+    cache->file_size = 0;
+    if (cache->file_pos != 0)
+        goto fail;
+
+    hd = (struct persist_header){
+        .magic = PERSIST_MAGIC,
+        .version = PERSIST_VERSION,
+        .lavc_version = avcodec_version(),
+        .key_len = key_len,
+    };
+    if (!write_raw(cache, &hd, sizeof(hd)) ||
+        !write_raw(cache, (void *)key, key_len))
+        goto fail;
+
+    return true;
+
+fail:
+    close(cache->fd);
+    cache->fd = -1;
+    cache->file_pos = 0;
+    cache->file_size = 0;
+    TA_FREEP(&cache->index_filename);
+    return false;
+}
+
+// Return the directory for cache files (--demuxer-cache-dir), creating it if
+// needed. Returns NULL if there is none.
+char *demux_cache_get_dir(void *ta_parent, struct mpv_global *global)
+{
+    struct demux_cache_opts *opts =
+        mp_get_config_group(NULL, global, &demux_cache_conf);
+
+    char *dir = NULL;
+    if (opts->cache_dir && opts->cache_dir[0]) {
+        dir = mp_get_user_path(ta_parent, global, opts->cache_dir);
+    } else {
+        dir = mp_find_user_file(ta_parent, global, "cache", "");
+    }
+    talloc_free(opts);
+
+    if (!dir || !dir[0]) {
+        talloc_free(dir);
+        return NULL;
+    }
+
+    mp_mkdirp(dir);
+    return dir;
+}
+
+// Create a cache. This also initializes the cache file from the options. The
+// log parameter must stay valid until demux_cache is destroyed.
+// If key is not NULL, it identifies the source media, and is used to reopen a
+// previously written cache file if --demuxer-cache-persistent is enabled.
+// Free with talloc_free().
+struct demux_cache *demux_cache_create(struct mpv_global *global,
+                                       struct mp_log *log, const char *key)
+{
+    struct demux_cache *cache = talloc_zero(NULL, struct demux_cache);
+    mp_mutex_init(&cache->lock);
+    mp_cond_init(&cache->wakeup);
+    talloc_set_destructor(cache, cache_destroy);
+    cache->opts = mp_get_config_group(cache, global, &demux_cache_conf);
+    cache->log = log;
+    cache->fd = -1;
+    cache->packet_pool = demux_packet_pool_alloc(cache);
+
+    char *cache_dir = demux_cache_get_dir(NULL, global);
+    if (!cache_dir)
+        goto fail;
+
+    if (cache->opts->persistent && key && key[0]) {
+        if (open_persistent(cache, cache_dir, key))
+            goto done;
+        MP_WARN(cache, "Failed to open persistent cache file, using a "
+                "temporary file instead.\n");
+    }
+
+    cache->filename = mp_path_join(cache, cache_dir, "mpv-cache-XXXXXX.dat");
+    cache->fd = mp_mkostemps(cache->filename, 4, O_CLOEXEC);
+    if (cache->fd < 0) {
+        MP_ERR(cache, "Failed to create cache temporary file.\n");
+        goto fail;
+    }
+    cache->need_unlink = true;
+    if (cache->opts->unlink_files >= 2) {
+        if (unlink(cache->filename)) {
+            MP_ERR(cache, "Failed to unlink cache temporary file after creation.\n");
+        } else {
+            cache->need_unlink = false;
+        }
+    }
+
+done:
+    talloc_free(cache_dir);
+
+    cache->flushed_size = cache->file_size;
+
+#if HAVE_POSIX
+    // Without pwrite(), writing can't be done concurrently with reading.
+    cache->writer_running = !mp_thread_create(&cache->writer, writer_thread, cache);
+    if (!cache->writer_running)
+        MP_WARN(cache, "Failed to create cache writer thread.\n");
+#endif
+
+    return cache;
+fail:
+    talloc_free(cache_dir);
+    talloc_free(cache);
+    return NULL;
+}
+
+uint64_t demux_cache_get_size(struct demux_cache *cache)
+{
+    return cache->file_size;
+}
+
+// Whether demux_cache_write() refuses packets because too much data is waiting
+// to be written. This is temporary, unlike write errors.
+bool demux_cache_is_busy(struct demux_cache *cache)
+{
+    mp_mutex_lock(&cache->lock);
+    bool busy = cache->num_batches >= MAX_PENDING_BATCHES &&
+                cache->batches[cache->num_batches - 1]->sealed &&
+                !cache->write_error;
+    mp_mutex_unlock(&cache->lock);
+    return busy;
+}
+
+// Wait until all pending data was written, so that demux_cache_write() accepts
+// packets again (unless writing failed).
+void demux_cache_flush(struct demux_cache *cache)
+{
+    mp_mutex_lock(&cache->lock);
+    flush_batches(cache);
+    mp_mutex_unlock(&cache->lock);
+}
+
+// Whether the cache file outlives the demuxer (and may contain packets
+// written by an earlier instance).
+bool demux_cache_is_persistent(struct demux_cache *cache)
+{
+    return !!cache->index_filename;
+}
+
+static void append_raw(struct write_batch *batch, const void *ptr, size_t len)
+{
+    bstr_xappend(batch, &batch->data, (bstr){(unsigned char *)ptr, len});
+}
+
+static bool take_raw(bstr *data, void *ptr, size_t len)
+{
+    if (data->len < len)
+        return false;
+    memcpy(ptr, data->start, len);
+    *data = bstr_cut(*data, len);
+    return true;
+}
+
 // Serialize a packet to the cache file. Returns the packet position, which can
 // be passed to demux_cache_read() to read the packet again.
-// Returns a negative value on errors, i.e. writing the file failed.
+// The data is written asynchronously in batches, and packets that were not
+// written yet are read from memory.
+// Returns a negative value on errors, i.e. writing the file failed earlier, or
+// if the writer thread is too far behind. This never waits for the disk, as
+// it's called with the demuxer lock held.
 int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
 {
     assert(dp->avpacket);
@@ -218,10 +579,27 @@ int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
     assert(dp->avpacket->side_data_elems >= 0 &&
            dp->avpacket->side_data_elems <= INT32_MAX);
 
-    if (!do_seek(cache, cache->file_size))
-        return -1;
+    mp_mutex_lock(&cache->lock);
+
+    int64_t pos = -1;
+    if (cache->write_error)
+        goto done;
+
+    struct write_batch *batch = NULL;
+    if (cache->num_batches && !cache->batches[cache->num_batches - 1]->sealed)
+        batch = cache->batches[cache->num_batches - 1];
+    if (!batch) {
+        // Let the caller keep the packet in memory until the disk catches up.
+        if (cache->num_batches >= MAX_PENDING_BATCHES)
+            goto done;
+        batch = talloc_zero(NULL, struct write_batch);
+        batch->pos = cache->file_size;
+        // (Most packets are small, so this avoids reallocations.)
+        batch->data.start = talloc_size(batch, WRITE_BATCH_SIZE + 1);
+        MP_TARRAY_APPEND(NULL, cache->batches, cache->num_batches, batch);
+    }
 
-    uint64_t pos = cache->file_pos;
+    pos = cache->file_size;
 
     struct pkt_header hd = {
         .data_len  = dp->len,
@@ -229,11 +607,9 @@ int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
         .num_sd = dp->avpacket->side_data_elems,
     };
 
-    if (!write_raw(cache, &hd, sizeof(hd)))
-        goto fail;
-
-    if (!write_raw(cache, dp->buffer, dp->len))
-        goto fail;
+    append_raw(batch, &hd, sizeof(hd));
+    append_raw(batch, dp->buffer, dp->len);
+    append_raw(batch, zero_padding, sizeof(zero_padding));
 
     // The handling of FFmpeg side data requires an extra long comment to
     // explain why this code is fragile and insane.
@@ -267,23 +643,215 @@ int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *dp)
             .len = sd->size,
         };
 
-        if (!write_raw(cache, &sd_hd, sizeof(sd_hd)))
+        append_raw(batch, &sd_hd, sizeof(sd_hd));
+        append_raw(batch, sd->data, sd->size);
+    }
+
+    cache->file_size = batch->pos + batch->data.len;
+
+    if (batch->data.len >= WRITE_BATCH_SIZE)
+        submit_batch(cache, batch);
+
+done:
+    mp_mutex_unlock(&cache->lock);
+    return pos;
+}
+
+// Parse a packet from data that is not yet written to the file.
+static struct demux_packet *read_from_batch(struct demux_cache *cache,
+                                            struct write_batch *batch,
+                                            uint64_t pos)
+{
+    bstr data = bstr_cut(batch->data, pos - batch->pos);
+    struct pkt_header hd;
+
+    if (!take_raw(&data, &hd, sizeof(hd)) || hd.data_len > INT_MAX ||
+        data.len < hd.data_len + sizeof(zero_padding))
+        return NULL;
+
+    struct demux_packet *dp =
+        new_demux_packet_from_pooled(cache->packet_pool, data.start, hd.data_len);
+    if (!dp)
+        return NULL;
+    data = bstr_cut(data, hd.data_len + sizeof(zero_padding));
+
+    dp->avpacket->flags = hd.av_flags;
+
+    for (uint32_t n = 0; n < hd.num_sd; n++) {
+        struct sd_header sd_hd;
+
+        if (!take_raw(&data, &sd_hd, sizeof(sd_hd)) || sd_hd.len > INT_MAX ||
+            data.len < sd_hd.len)
             goto fail;
-        if (!write_raw(cache, sd->data, sd->size))
+
+        uint8_t *sd = av_packet_new_side_data(dp->avpacket, sd_hd.av_type,
+                                              sd_hd.len);
+        if (!sd)
             goto fail;
+
+        take_raw(&data, sd, sd_hd.len);
     }
 
-    return pos;
+    return dp;
+
+fail:
+    talloc_free(dp);
+    return NULL;
+}
+
+// Called locked. Returns true and sets *out if pos is in a pending batch.
+static bool read_pending(struct demux_cache *cache, uint64_t pos,
+                         struct demux_packet **out)
+{
+    if (pos < cache->flushed_size)
+        return false;
+
+    *out = NULL;
+    for (int n = 0; n < cache->num_batches; n++) {
+        struct write_batch *batch = cache->batches[n];
+        if (pos >= batch->pos && pos < batch->pos + batch->data.len) {
+            *out = read_from_batch(cache, batch, pos);
+            break;
+        }
+    }
+    return true;
+}
+
+#if HAVE_POSIX
+
+static void unmap_file(void *opaque, uint8_t *data)
+{
+    munmap(data, (size_t)(uintptr_t)opaque);
+}
+
+static void unref_mapping(void *opaque, uint8_t *data)
+{
+    AVBufferRef *map = opaque;
+    av_buffer_unref(&map);
+}
+
+// Make sure the file is mapped at least up to end. Returns false if this is
+// not possible, or not worth it.
+static bool update_mapping(struct demux_cache *cache, uint64_t end)
+{
+    if (end <= cache->map_size)
+        return true;
+
+    // Only data that was actually written can be mapped.
+    mp_mutex_lock(&cache->lock);
+    uint64_t file_size = cache->flushed_size;
+    mp_mutex_unlock(&cache->lock);
+
+    if (end > file_size || file_size > SIZE_MAX)
+        return false;
+
+    if (cache->map && file_size - cache->map_size < MAP_GROW_MIN)
+        return false;
+
+    size_t size = file_size;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, cache->fd, 0);
+    if (ptr == MAP_FAILED) {
+        MP_WARN(cache, "Failed to map cache file: %s\n", mp_strerror(errno));
+        return false;
+    }
+
+    AVBufferRef *map = av_buffer_create(ptr, size, unmap_file,
+                                        (void *)(uintptr_t)size,
+                                        AV_BUFFER_FLAG_READONLY);
+    if (!map) {
+        munmap(ptr, size);
+        return false;
+    }
+
+    // Packets still referencing the old mapping keep it alive.
+    av_buffer_unref(&cache->map);
+    cache->map = map;
+    cache->map_size = size;
+
+    MP_DBG(cache, "Mapped %zu bytes of cache file.\n", size);
+    return true;
+}
+
+// Return a packet whose payload references the mapped file directly. Returns
+// NULL if the packet is not (or can not be) mapped, in which case the caller
+// should use the normal read path.
+static struct demux_packet *read_mapped(struct demux_cache *cache, uint64_t pos)
+{
+    struct pkt_header hd;
+
+    if (!update_mapping(cache, pos + sizeof(hd)))
+        return NULL;
+    memcpy(&hd, cache->map->data + pos, sizeof(hd));
+    pos += sizeof(hd);
+
+    uint64_t data_pos = pos;
+    pos += hd.data_len + sizeof(zero_padding);
+    if (hd.data_len > INT_MAX || !update_mapping(cache, pos))
+        return NULL;
+
+    AVBufferRef *map = av_buffer_ref(cache->map);
+    if (!map)
+        return NULL;
+    AVBufferRef *buf = av_buffer_create(map->data + data_pos, hd.data_len,
+                                        unref_mapping, map,
+                                        AV_BUFFER_FLAG_READONLY);
+    if (!buf) {
+        av_buffer_unref(&map);
+        return NULL;
+    }
+    struct demux_packet *dp = new_demux_packet_from_buf(buf);
+    av_buffer_unref(&buf);
+    if (!dp)
+        return NULL;
+
+    dp->avpacket->flags = hd.av_flags;
+
+    for (uint32_t n = 0; n < hd.num_sd; n++) {
+        struct sd_header sd_hd;
+
+        if (!update_mapping(cache, pos + sizeof(sd_hd)))
+            goto fail;
+        memcpy(&sd_hd, cache->map->data + pos, sizeof(sd_hd));
+        pos += sizeof(sd_hd);
+
+        if (sd_hd.len > INT_MAX || !update_mapping(cache, pos + sd_hd.len))
+            goto fail;
+
+        uint8_t *sd = av_packet_new_side_data(dp->avpacket, sd_hd.av_type,
+                                              sd_hd.len);
+        if (!sd)
+            goto fail;
+
+        memcpy(sd, cache->map->data + pos, sd_hd.len);
+        pos += sd_hd.len;
+    }
+
+    return dp;
 
 fail:
-    // Reset file_size (try not to append crap forever).
-    do_seek(cache, pos);
-    cache->file_size = cache->file_pos;
-    return -1;
+    talloc_free(dp);
+    return NULL;
 }
 
+#endif
+
 struct demux_packet *demux_cache_read(struct demux_cache *cache, uint64_t pos)
 {
+    struct demux_packet *pending = NULL;
+    mp_mutex_lock(&cache->lock);
+    bool is_pending = read_pending(cache, pos, &pending);
+    mp_mutex_unlock(&cache->lock);
+    if (is_pending)
+        return pending;
+
+#if HAVE_POSIX
+    if (cache->opts->use_mmap) {
+        struct demux_packet *dp = read_mapped(cache, pos);
+        if (dp)
+            return dp;
+    }
+#endif
+
     if (!do_seek(cache, pos))
         return NULL;
 
@@ -292,11 +860,13 @@ struct demux_packet *demux_cache_read(struct demux_cache *cache, uint64_t pos)
     if (!read_raw(cache, &hd, sizeof(hd)))
         return NULL;
 
-    struct demux_packet *dp = new_demux_packet(hd.data_len);
+    struct demux_packet *dp = new_demux_packet_pooled(cache->packet_pool,
+                                                      hd.data_len);
     if (!dp)
         goto fail;
 
-    if (!read_raw(cache, dp->buffer, dp->len))
+    // (The packet buffer has space for the padding, which is all zeros.)
+    if (!read_raw(cache, dp->buffer, dp->len + sizeof(zero_padding)))
         goto fail;
 
     dp->avpacket->flags = hd.av_flags;
@@ -325,3 +895,48 @@ fail:
     talloc_free(dp);
     return NULL;
 }
+
+// Write the index of a persistent cache, which describes the packets that
+// can be restored from the cache file. Replaces any previously written index.
+bool demux_cache_write_index(struct demux_cache *cache,
+                             struct demux_cache_index *index)
+{
+    if (!cache->index_filename)
+        return false;
+
+    mp_mutex_lock(&cache->lock);
+    flush_batches(cache);
+    bool write_error = cache->write_error;
+    mp_mutex_unlock(&cache->lock);
+
+    // The index would reference data that is not in the file.
+    if (write_error)
+        return false;
+
+    bstr data = demux_cache_index_serialize(NULL, index, cache->flushed_size);
+
+    bool ok = mp_save_to_file(cache->index_filename, data.start, data.len);
+    if (!ok)
+        MP_ERR(cache, "Failed to write cache index file.\n");
+    talloc_free(data.start);
+    return ok;
+}
+
+// Read the index written by demux_cache_write_index(). Returns NULL if there
+// is none, or if it doesn't match the cache file. Free with talloc_free().
+struct demux_cache_index *demux_cache_read_index(struct demux_cache *cache)
+{
+    if (!cache->index_filename)
+        return NULL;
+
+    int fd = open(cache->index_filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct demux_cache_index *index =
+        demux_cache_index_read(NULL, fd, cache->file_size);
+    if (!index)
+        MP_WARN(cache, "Ignoring invalid cache index file.\n");
+    close(fd);
+    return index;
+}
@@ -1,16 +1,62 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "misc/bstr.h"
+
 struct demux_packet;
 struct mp_log;
 struct mpv_global;
 
 struct demux_cache;
 
+// Packet metadata for a persisted cache range. The packet data itself is in
+// the cache file at cache_pos.
+struct demux_cache_index_pkt {
+    uint64_t cache_pos;     // as returned by demux_cache_write()
+    int64_t pos;
+    double pts, dts, duration;
+    uint32_t keyframe;
+};
+
+// One stream of a persisted cache range. Followed by num_pkts entries in
+// demux_cache_index.pkts.
+struct demux_cache_index_queue {
+    uint32_t range;         // ranges are numbered from 0, entries are sorted
+    uint32_t stream;        // sh_stream.index
+    uint64_t num_pkts;
+    double seek_start, seek_end, last_pruned;
+    uint32_t is_bof, is_eof;
+};
+
+struct demux_cache_index {
+    char *streams_sig;      // identifies the set of streams, must match
+    struct demux_cache_index_queue *queues;
+    size_t num_queues;
+    struct demux_cache_index_pkt *pkts;
+    size_t num_pkts;
+};
+
+char *demux_cache_get_dir(void *ta_parent, struct mpv_global *global);
+
 struct demux_cache *demux_cache_create(struct mpv_global *global,
-                                       struct mp_log *log);
+                                       struct mp_log *log, const char *key);
 
 int64_t demux_cache_write(struct demux_cache *cache, struct demux_packet *pkt);
 struct demux_packet *demux_cache_read(struct demux_cache *cache, uint64_t pos);
 uint64_t demux_cache_get_size(struct demux_cache *cache);
+bool demux_cache_is_busy(struct demux_cache *cache);
+void demux_cache_flush(struct demux_cache *cache);
+
+bool demux_cache_is_persistent(struct demux_cache *cache);
+bool demux_cache_write_index(struct demux_cache *cache,
+                             struct demux_cache_index *index);
+struct demux_cache_index *demux_cache_read_index(struct demux_cache *cache);
+
+// Index file format (cache_index.c).
+bstr demux_cache_index_serialize(void *ta_parent, struct demux_cache_index *index,
+                                 uint64_t data_size);
+struct demux_cache_index *demux_cache_index_read(void *ta_parent, int fd,
+                                                 uint64_t max_data_size);
@@ -0,0 +1,139 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "cache.h"
+#include "misc/bstr.h"
+#include "mpv_talloc.h"
+#include "osdep/io.h"
+
+// Header of the index file that belongs to a persistent cache file. It's
+// followed by the stream signature, the queue entries, and the packet entries.
+#define INDEX_MAGIC "mpvdcidx"
+#define INDEX_VERSION 1
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t sig_len;
+    uint64_t data_size;
+    uint64_t num_queues;
+    uint64_t num_pkts;
+};
+
+// Serialize the index to the index file format. data_size is the amount of
+// data in the cache file the index refers to. Free with talloc_free().
+bstr demux_cache_index_serialize(void *ta_parent, struct demux_cache_index *index,
+                                 uint64_t data_size)
+{
+    struct index_header hd = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .sig_len = strlen(index->streams_sig),
+        .data_size = data_size,
+        .num_queues = index->num_queues,
+        .num_pkts = index->num_pkts,
+    };
+
+    bstr data = {0};
+    bstr_xappend(ta_parent, &data, (bstr){(void *)&hd, sizeof(hd)});
+    bstr_xappend(ta_parent, &data, bstr0(index->streams_sig));
+    bstr_xappend(ta_parent, &data, (bstr){(void *)index->queues,
+                        index->num_queues * sizeof(index->queues[0])});
+    bstr_xappend(ta_parent, &data, (bstr){(void *)index->pkts,
+                        index->num_pkts * sizeof(index->pkts[0])});
+    return data;
+}
+
+static bool read_full(int fd, void *ptr, size_t len)
+{
+    while (len) {
+        ssize_t r = read(fd, ptr, len);
+        if (r <= 0)
+            return false;
+        ptr = (char *)ptr + r;
+        len -= r;
+    }
+    return true;
+}
+
+// Parse the index file in fd (at file position 0). Returns NULL if it's not a
+// valid index, or refers to more than max_data_size bytes of the cache file.
+// The header must describe exactly the file's size, so a corrupt file can't
+// cause large allocations. Free with talloc_free().
+struct demux_cache_index *demux_cache_index_read(void *ta_parent, int fd,
+                                                 uint64_t max_data_size)
+{
+    struct demux_cache_index *index = NULL;
+
+    struct stat st;
+    struct index_header hd;
+    if (fstat(fd, &st) || st.st_size < sizeof(hd) ||
+        !read_full(fd, &hd, sizeof(hd)) ||
+        memcmp(hd.magic, INDEX_MAGIC, sizeof(hd.magic)) != 0 ||
+        hd.version != INDEX_VERSION || hd.data_size > max_data_size)
+        return NULL;
+
+    // Compute the expected size without overflowing, even for bogus counts.
+    uint64_t rest = st.st_size - sizeof(hd);
+    if (hd.sig_len > rest)
+        return NULL;
+    rest -= hd.sig_len;
+    if (hd.num_queues > rest / sizeof(index->queues[0]))
+        return NULL;
+    rest -= hd.num_queues * sizeof(index->queues[0]);
+    if (rest % sizeof(index->pkts[0]) ||
+        hd.num_pkts != rest / sizeof(index->pkts[0]))
+        return NULL;
+
+    index = talloc_zero(ta_parent, struct demux_cache_index);
+    index->streams_sig = talloc_zero_size(index, hd.sig_len + 1);
+    index->num_queues = hd.num_queues;
+    index->queues = talloc_array(index, struct demux_cache_index_queue,
+                                 index->num_queues);
+    index->num_pkts = hd.num_pkts;
+    index->pkts = talloc_array(index, struct demux_cache_index_pkt,
+                               index->num_pkts);
+
+    if (!read_full(fd, index->streams_sig, hd.sig_len) ||
+        !read_full(fd, index->queues,
+                   index->num_queues * sizeof(index->queues[0])) ||
+        !read_full(fd, index->pkts, index->num_pkts * sizeof(index->pkts[0])))
+        goto fail;
+
+    uint64_t total_pkts = 0;
+    for (size_t n = 0; n < index->num_queues; n++) {
+        if (index->queues[n].num_pkts > index->num_pkts - total_pkts)
+            goto fail;
+        total_pkts += index->queues[n].num_pkts;
+    }
+    if (total_pkts != index->num_pkts)
+        goto fail;
+    for (size_t n = 0; n < index->num_pkts; n++) {
+        if (index->pkts[n].cache_pos >= hd.data_size)
+            goto fail;
+    }
+
+    return index;
+
+fail:
+    talloc_free(index);
+    return NULL;
+}
@@ -91,6 +91,7 @@ const struct m_sub_options demux_conf = {
         {"cache", OPT_CHOICE(enable_cache,
             {"no", 0}, {"auto", -1}, {"yes", 1})},
         {"cache-on-disk", OPT_BOOL(disk_cache)},
+        {"demuxer-cache-spill", OPT_BOOL(cache_spill)},
         {"demuxer-readahead-secs", OPT_DOUBLE(min_secs), M_RANGE(0, DBL_MAX)},
         {"demuxer-hysteresis-secs", OPT_DOUBLE(hyst_secs), M_RANGE(0, DBL_MAX)},
         {"demuxer-max-bytes", OPT_BYTE_SIZE(max_bytes),
@@ -186,6 +187,11 @@ struct demux_internal {
     int events;
 
     struct demux_cache *cache;
+    // Ranges read from a persistent cache, restored on first use.
+    struct demux_cache_index *cache_index;
+    uint64_t spilled_bytes;     // for demux_reader_state.file_cache_spilled
+    uint64_t mem_cache_reads;
+    uint64_t file_cache_reads;
 
     bool warned_queue_overflow;
     bool eof;                   // whether we're in EOF state
@@ -341,6 +347,10 @@ struct demux_queue {
     struct demux_packet *keyframe_latest;
     struct demux_packet *keyframe_first; // cached value of first KF packet
 
+    // Last packet that was considered for moving to the file cache (all
+    // packets before it were), or NULL. See spill_queue().
+    struct demux_packet *spilled_tail;
+
     // incrementally maintained seek range, possibly invalid
     double seek_start, seek_end;
     double last_pruned;     // timestamp of last pruned keyframe
@@ -446,6 +456,8 @@ static void find_backward_restart_pos(struct demux_stream *ds);
 static struct demux_packet *find_seek_target(struct demux_queue *queue,
                                              double pts, int flags);
 static void prune_old_packets(struct demux_internal *in);
+static uint64_t spill_queue(struct demux_internal *in, struct demux_queue *queue,
+                            bool all);
 static void dumper_close(struct demux_internal *in);
 static void demux_convert_tags_charset(struct demuxer *demuxer);
 
@@ -687,6 +699,8 @@ static void remove_head_packet(struct demux_queue *queue)
         queue->keyframe_first = NULL;
     if (queue->keyframe_latest == dp)
         queue->keyframe_latest = NULL;
+    if (queue->spilled_tail == dp)
+        queue->spilled_tail = NULL;
     queue->is_bof = false;
 
     uint64_t end_pos = dp->next ? dp->next->cum_pos : queue->tail_cum_pos;
@@ -736,6 +750,7 @@ static void clear_queue(struct demux_queue *queue)
     queue->head = queue->tail = NULL;
     queue->keyframe_first = NULL;
     queue->keyframe_latest = NULL;
+    queue->spilled_tail = NULL;
     queue->seek_start = queue->seek_end = queue->last_pruned = MP_NOPTS_VALUE;
 
     queue->correct_dts = queue->correct_pos = true;
@@ -1067,6 +1082,101 @@ int demux_get_num_stream(struct demuxer *demuxer)
     return r;
 }
 
+// Identifies the set of streams for persisted cache ranges. Restoring ranges
+// into a demuxer with different streams would associate packets with the
+// wrong stream.
+static char *get_streams_sig(void *ta_ctx, struct demux_internal *in)
+{
+    char *sig = talloc_strdup(ta_ctx, "");
+    for (int n = 0; n < in->num_streams; n++) {
+        struct sh_stream *sh = in->streams[n];
+        sig = talloc_asprintf_append(sig, "%s:%s:%d;",
+                                     stream_type_name(sh->type),
+                                     sh->codec->codec, sh->demuxer_id);
+    }
+    return sig;
+}
+
+// Whether all packets of the range can be restored from the disk cache.
+static bool range_is_persistable(struct demux_cached_range *range)
+{
+    for (int n = 0; n < range->num_streams; n++) {
+        struct demux_queue *queue = range->streams[n];
+        for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+            if (!dp->is_cached || dp->segmented)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Write the metadata of all seekable cached ranges to the persistent cache,
+// so that a later instance can reuse the packets in the cache file.
+static void save_cache_index(struct demux_internal *in)
+{
+    // Write the packets that were refused while the cache was busy, so that
+    // their ranges can be persisted. This waits for the disk.
+    if (in->d_user->opts->disk_cache) {
+        for (int n = 0; n < in->num_ranges; n++) {
+            struct demux_cached_range *range = in->ranges[n];
+            for (int i = 0; i < range->num_streams; i++) {
+                struct demux_queue *queue = range->streams[i];
+                while (1) {
+                    spill_queue(in, queue, true);
+                    if (queue->spilled_tail == queue->tail)
+                        break;
+                    demux_cache_flush(in->cache);
+                }
+            }
+        }
+    }
+
+    struct demux_cache_index *index = talloc_zero(NULL, struct demux_cache_index);
+    index->streams_sig = get_streams_sig(index, in);
+
+    uint32_t num_ranges = 0;
+    for (int n = 0; n < in->num_ranges; n++) {
+        struct demux_cached_range *range = in->ranges[n];
+        if (range->seek_start == MP_NOPTS_VALUE || !range_is_persistable(range))
+            continue;
+
+        for (int i = 0; i < range->num_streams; i++) {
+            struct demux_queue *queue = range->streams[i];
+            struct demux_cache_index_queue iq = {
+                .range = num_ranges,
+                .stream = i,
+                .seek_start = queue->seek_start,
+                .seek_end = queue->seek_end,
+                .last_pruned = queue->last_pruned,
+                .is_bof = queue->is_bof,
+                .is_eof = queue->is_eof,
+            };
+            for (struct demux_packet *dp = queue->head; dp; dp = dp->next) {
+                MP_TARRAY_APPEND(index, index->pkts, index->num_pkts,
+                    (struct demux_cache_index_pkt){
+                        .cache_pos = dp->cached_data.pos,
+                        .pos = dp->pos,
+                        .pts = dp->pts,
+                        .dts = dp->dts,
+                        .duration = dp->duration,
+                        .keyframe = dp->keyframe,
+                    });
+                iq.num_pkts += 1;
+            }
+            MP_TARRAY_APPEND(index, index->queues, index->num_queues, iq);
+        }
+        num_ranges += 1;
+    }
+
+    if (num_ranges) {
+        MP_VERBOSE(in, "Saving %"PRIu32" cached ranges (%zu packets) to "
+                   "persistent cache.\n", num_ranges, index->num_pkts);
+        demux_cache_write_index(in->cache, index);
+    }
+
+    talloc_free(index);
+}
+
 // It's UB to call anything but demux_dealloc() on the demuxer after this.
 static void demux_shutdown(struct demux_internal *in)
 {
@@ -1084,6 +1194,13 @@ static void demux_shutdown(struct demux_internal *in)
     demuxer->priv = NULL;
     in->d_thread->priv = NULL;
 
+    if (in->cache && demux_cache_is_persistent(in->cache)) {
+        mp_mutex_lock(&in->lock);
+        save_cache_index(in);
+        mp_mutex_unlock(&in->lock);
+    }
+    TA_FREEP(&in->cache_index);
+
     demux_flush(demuxer);
     assert(in->total_bytes == 0);
 
@@ -1595,12 +1712,34 @@ static void back_demux_see_packets(struct demux_stream *ds)
         find_backward_restart_pos(ds);
 }
 
+// Make room for at least one more index entry.
+static void grow_index(struct demux_queue *queue)
+{
+    struct demux_internal *in = queue->ds->in;
+
+    if (queue->num_index < queue->index_size)
+        return;
+
+    // Needs to honor power-of-2 requirement.
+    size_t new_size = MPMAX(128, queue->index_size * 2);
+    assert(!(new_size & (new_size - 1)));
+    MP_DBG(in, "stream %d: resize index to %zu\n", queue->ds->index,
+           new_size);
+    // Note: we could tolerate allocation failure, and just discard the
+    // entire index (and prevent the index from being recreated).
+    MP_RESIZE_ARRAY(NULL, queue->index, new_size);
+    size_t highest_index = queue->index0 + queue->num_index;
+    for (size_t n = queue->index_size; n < highest_index; n++)
+        queue->index[n] = queue->index[n - queue->index_size];
+    in->total_bytes +=
+        (new_size - queue->index_size) * sizeof(queue->index[0]);
+    queue->index_size = new_size;
+}
+
 // Add the keyframe to the end of the index. Not all packets are actually added.
 static void add_index_entry(struct demux_queue *queue, struct demux_packet *dp,
                             double pts)
 {
-    struct demux_internal *in = queue->ds->in;
-
     assert(dp->keyframe && pts != MP_NOPTS_VALUE);
 
     if (queue->num_index > 0) {
@@ -1609,22 +1748,7 @@ static void add_index_entry(struct demux_queue *queue, struct demux_packet *dp,
             return;
     }
 
-    if (queue->num_index == queue->index_size) {
-        // Needs to honor power-of-2 requirement.
-        size_t new_size = MPMAX(128, queue->index_size * 2);
-        assert(!(new_size & (new_size - 1)));
-        MP_DBG(in, "stream %d: resize index to %zu\n", queue->ds->index,
-               new_size);
-        // Note: we could tolerate allocation failure, and just discard the
-        // entire index (and prevent the index from being recreated).
-        MP_RESIZE_ARRAY(NULL, queue->index, new_size);
-        size_t highest_index = queue->index0 + queue->num_index;
-        for (size_t n = queue->index_size; n < highest_index; n++)
-            queue->index[n] = queue->index[n - queue->index_size];
-        in->total_bytes +=
-            (new_size - queue->index_size) * sizeof(queue->index[0]);
-        queue->index_size = new_size;
-    }
+    grow_index(queue);
 
     assert(queue->num_index < queue->index_size);
 
@@ -1636,6 +1760,171 @@ static void add_index_entry(struct demux_queue *queue, struct demux_packet *dp,
     };
 }
 
+// Append the index of q2 to the index of q1, and clear q2's index. Only the
+// entries of the smaller index are copied; if that is q1's, they're prepended
+// to q2's ring buffer, which is then moved to q1.
+static void merge_index(struct demux_queue *q1, struct demux_queue *q2)
+{
+    if (q1->num_index >= q2->num_index) {
+        for (size_t i = 0; i < q2->num_index; i++) {
+            struct index_entry *e = &QUEUE_INDEX_ENTRY(q2, i);
+            add_index_entry(q1, e->pkt, e->pts);
+        }
+        free_index(q2);
+        return;
+    }
+
+    for (size_t i = q1->num_index; i > 0; i--) {
+        struct index_entry e = QUEUE_INDEX_ENTRY(q1, i - 1);
+        grow_index(q2);
+        q2->index0 = (q2->index0 - 1) & QUEUE_INDEX_SIZE_MASK(q2);
+        q2->num_index += 1;
+        QUEUE_INDEX_ENTRY(q2, 0) = e;
+    }
+    free_index(q1);
+
+    q1->index = q2->index;
+    q1->index_size = q2->index_size;
+    q1->index0 = q2->index0;
+    q1->num_index = q2->num_index;
+
+    // Ownership (and total_bytes accounting) moved to q1.
+    q2->index = NULL;
+    q2->index_size = 0;
+    q2->index0 = 0;
+    q2->num_index = 0;
+}
+
+// Append a packet restored from the persistent cache to a non-current range.
+static void append_restored_packet(struct demux_queue *queue,
+                                   struct demux_packet *dp)
+{
+    struct demux_internal *in = queue->ds->in;
+
+    queue->correct_pos &= dp->pos >= 0 && dp->pos > queue->last_pos;
+    queue->correct_dts &= dp->dts != MP_NOPTS_VALUE && dp->dts > queue->last_dts;
+    queue->last_pos = dp->pos;
+    queue->last_dts = dp->dts;
+
+    double ts = MP_PTS_OR_DEF(dp->dts, dp->pts);
+    if (ts != MP_NOPTS_VALUE && (ts > queue->last_ts || ts + 10 < queue->last_ts))
+        queue->last_ts = ts;
+
+    size_t bytes = demux_packet_estimate_total_size(dp);
+    in->total_bytes += bytes;
+    dp->cum_pos = queue->tail_cum_pos;
+    queue->tail_cum_pos += bytes;
+
+    if (queue->tail) {
+        queue->tail->next = dp;
+        queue->tail = dp;
+    } else {
+        queue->head = queue->tail = dp;
+    }
+}
+
+// Recreate the cached ranges stored by a previous instance in the persistent
+// disk cache. This is delayed until the first packet read or seek, because
+// cached ranges are only retained for selected streams.
+static void restore_cache_index(struct demux_internal *in)
+{
+    struct demux_cache_index *index = in->cache_index;
+    if (!index)
+        return;
+    in->cache_index = NULL;
+
+    assert(in->current_range && in->num_ranges > 0);
+
+    char *sig = get_streams_sig(index, in);
+    if (strcmp(sig, index->streams_sig) != 0) {
+        MP_VERBOSE(in, "Streams changed, not restoring persistent cache.\n");
+        goto done;
+    }
+
+    struct demux_cached_range *range = NULL;
+    int num_ranges = 0;
+    size_t pkt_idx = 0;
+    for (size_t n = 0; n < index->num_queues; n++) {
+        struct demux_cache_index_queue *iq = &index->queues[n];
+        if (iq->stream >= in->num_streams)
+            break;
+
+        if (!range || (int)iq->range != num_ranges - 1) {
+            if (range)
+                update_seek_ranges(range);
+            range = talloc_ptrtype(NULL, range);
+            *range = (struct demux_cached_range){
+                .seek_start = MP_NOPTS_VALUE,
+                .seek_end = MP_NOPTS_VALUE,
+            };
+            add_missing_streams(in, range);
+            // Keep in->current_range as the last entry.
+            MP_TARRAY_INSERT_AT(in, in->ranges, in->num_ranges,
+                                in->num_ranges - 1, range);
+            num_ranges += 1;
+        }
+
+        struct demux_stream *ds = in->streams[iq->stream]->ds;
+        struct demux_queue *queue = range->streams[iq->stream];
+        struct demux_cache_index_pkt *pkts = &index->pkts[pkt_idx];
+        pkt_idx += iq->num_pkts;
+
+        if (!ds->selected)
+            continue;
+
+        for (size_t i = 0; i < iq->num_pkts; i++) {
+            struct demux_packet *dp = new_demux_packet(0);
+            MP_HANDLE_OOM(dp);
+            demux_packet_unref_contents(dp);
+            dp->is_cached = true;
+            dp->cached_data.pos = pkts[i].cache_pos;
+            dp->pos = pkts[i].pos;
+            dp->pts = pkts[i].pts;
+            dp->dts = pkts[i].dts;
+            dp->duration = pkts[i].duration;
+            dp->keyframe = pkts[i].keyframe;
+            dp->stream = iq->stream;
+            append_restored_packet(queue, dp);
+        }
+
+        // Rebuild the seek index.
+        struct demux_packet *dp = queue->head;
+        while (dp) {
+            if (!dp->keyframe) {
+                dp = dp->next;
+                continue;
+            }
+            if (!queue->keyframe_first)
+                queue->keyframe_first = dp;
+            queue->keyframe_latest = dp;
+            double kf_min;
+            struct demux_packet *next = compute_keyframe_times(dp, &kf_min, NULL);
+            if (kf_min != MP_NOPTS_VALUE)
+                add_index_entry(queue, dp, kf_min);
+            dp = next;
+        }
+
+        queue->seek_start = iq->seek_start;
+        queue->seek_end = iq->seek_end;
+        queue->last_pruned = iq->last_pruned;
+        queue->is_bof = iq->is_bof;
+        queue->is_eof = iq->is_eof;
+
+        ds->global_correct_pos &= queue->correct_pos;
+        ds->global_correct_dts &= queue->correct_dts;
+    }
+    if (range)
+        update_seek_ranges(range);
+
+    MP_VERBOSE(in, "Restored %d cached ranges from persistent cache.\n",
+               num_ranges);
+
+    free_empty_cached_ranges(in);
+
+done:
+    talloc_free(index);
+}
+
 // Check whether the next range in the list is, and if it appears to overlap,
 // try joining it into a single range.
 static void attempt_range_joining(struct demux_internal *in)
@@ -1749,6 +2038,7 @@ static void attempt_range_joining(struct demux_internal *in)
 
         // First new packet that is appended to the current range.
         struct demux_packet *join_point = q2->head;
+        struct demux_packet *q1_head = q1->head;
 
         if (q2->head) {
             if (q1->head) {
@@ -1773,25 +2063,35 @@ static void attempt_range_joining(struct demux_internal *in)
         q2->head = q2->tail = NULL;
         q2->keyframe_first = NULL;
         q2->keyframe_latest = NULL;
+        q2->spilled_tail = NULL;
 
         if (ds->selected && !ds->reader_head)
             ds->reader_head = join_point;
         ds->skip_to_keyframe = false;
 
-        // Make the cum_pos values in all q2 packets continuous.
-        for (struct demux_packet *dp = join_point; dp; dp = dp->next) {
-            uint64_t next_pos = dp->next ? dp->next->cum_pos : q2->tail_cum_pos;
-            uint64_t size = next_pos - dp->cum_pos;
-            dp->cum_pos = q1->tail_cum_pos;
-            q1->tail_cum_pos += size;
+        // Make the cum_pos values continuous. Only the differences between
+        // them matter (so wrapping around is fine), which means it's enough
+        // to shift the packets of the smaller side. Usually this is q1, the
+        // range that was started by the seek that led to the join.
+        if (join_point) {
+            uint64_t q1_bytes = q1_head ? q1->tail_cum_pos - q1_head->cum_pos : 0;
+            uint64_t q2_bytes = q2->tail_cum_pos - join_point->cum_pos;
+            if (q1_bytes < q2_bytes) {
+                uint64_t offset = join_point->cum_pos - q1->tail_cum_pos;
+                for (struct demux_packet *dp = q1_head; dp && dp != join_point;
+                     dp = dp->next)
+                    dp->cum_pos += offset;
+                q1->tail_cum_pos = q2->tail_cum_pos;
+            } else {
+                uint64_t offset = q1->tail_cum_pos - join_point->cum_pos;
+                for (struct demux_packet *dp = join_point; dp; dp = dp->next)
+                    dp->cum_pos += offset;
+                q1->tail_cum_pos += q2_bytes;
+            }
         }
 
         // And update the index with packets from q2.
-        for (size_t i = 0; i < q2->num_index; i++) {
-            struct index_entry *e = &QUEUE_INDEX_ENTRY(q2, i);
-            add_index_entry(q1, e->pkt, e->pts);
-        }
-        free_index(q2);
+        merge_index(q1, q2);
 
         // For moving demuxer position.
         ds->refreshing = ds->selected;
@@ -2049,15 +2349,6 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
 
     record_packet(in, dp);
 
-    if (in->cache && in->d_user->opts->disk_cache) {
-        int64_t pos = demux_cache_write(in->cache, dp);
-        if (pos >= 0) {
-            demux_packet_unref_contents(dp);
-            dp->is_cached = true;
-            dp->cached_data.pos = pos;
-        }
-    }
-
     queue->correct_pos &= dp->pos >= 0 && dp->pos > queue->last_pos;
     queue->correct_dts &= dp->dts != MP_NOPTS_VALUE && dp->dts > queue->last_dts;
     queue->last_pos = dp->pos;
@@ -2086,6 +2377,10 @@ static void add_packet_locked(struct sh_stream *stream, demux_packet_t *dp)
         queue->head = queue->tail = dp;
     }
 
+    // Also writes packets the cache refused earlier, because it was busy.
+    if (in->cache && in->d_user->opts->disk_cache)
+        spill_queue(in, queue, true);
+
     if (!ds->ignore_eof) {
         // obviously not true anymore
         ds->eof = false;
@@ -2169,6 +2464,8 @@ static bool read_packet(struct demux_internal *in)
     if (!was_reading || in->blocked || demux_cancel_test(in->d_thread))
         return false;
 
+    restore_cache_index(in);
+
     // Check if we need to read a new packet. We do this if all queues are below
     // the minimum, or if a stream explicitly needs new packets. Also includes
     // safe-guards against packet queue overflow.
@@ -2291,6 +2588,70 @@ static bool read_packet(struct demux_internal *in)
     return true;
 }
 
+// Move the back buffer packets of the queue (or all packets, if all is set) to
+// the file cache, and update the memory accounting. Stops early if the cache
+// is busy; the remaining packets are written by the next call. Returns the
+// number of bytes freed.
+static uint64_t spill_queue(struct demux_internal *in, struct demux_queue *queue,
+                            bool all)
+{
+    // Packets before reader_head are not needed for playback.
+    struct demux_packet *end = NULL;
+    if (!all && queue->ds->queue == queue)
+        end = queue->ds->reader_head;
+
+    struct demux_packet *dp =
+        queue->spilled_tail ? queue->spilled_tail->next : queue->head;
+    // Bytes freed so far; the cum_pos of all following packets shrinks by it.
+    uint64_t freed = 0;
+    for (; dp && dp != end; dp = dp->next) {
+        // Retry later, instead of skipping packets for good.
+        if (!dp->is_cached && demux_cache_is_busy(in->cache))
+            break;
+        dp->cum_pos -= freed;
+        // (Packets which can't be written are skipped, and stay in memory.)
+        if (!dp->is_cached) {
+            size_t len = dp->len;
+            size_t size = demux_packet_estimate_total_size(dp);
+            int64_t pos = demux_cache_write(in->cache, dp);
+            if (pos >= 0) {
+                demux_packet_unref_contents(dp);
+                dp->is_cached = true;
+                dp->cached_data.pos = pos;
+                if (!all)
+                    in->spilled_bytes += len;
+                freed += size - demux_packet_estimate_total_size(dp);
+            }
+        }
+        queue->spilled_tail = dp;
+    }
+
+    if (!freed)
+        return 0;
+
+    // Shift the packets after the spilled ones.
+    for (; dp; dp = dp->next)
+        dp->cum_pos -= freed;
+    in->total_bytes -= freed;
+    queue->tail_cum_pos -= freed;
+    return freed;
+}
+
+// Middle tier between keeping packets in memory and pruning them: move the
+// back buffer of the least recently used ranges to the file cache. Returns
+// whether any memory was freed.
+static bool spill_back_buffer(struct demux_internal *in)
+{
+    for (int n = 0; n < in->num_ranges; n++) {
+        struct demux_cached_range *range = in->ranges[n];
+        for (int i = 0; i < range->num_streams; i++) {
+            if (spill_queue(in, range->streams[i], false))
+                return true;
+        }
+    }
+    return false;
+}
+
 static void prune_old_packets(struct demux_internal *in)
 {
     assert(in->current_range == in->ranges[in->num_ranges - 1]);
@@ -2312,6 +2673,9 @@ static void prune_old_packets(struct demux_internal *in)
         if (in->total_bytes - fw_bytes <= max_avail)
             break;
 
+        if (in->cache && in->d_user->opts->cache_spill && spill_back_buffer(in))
+            continue;
+
         // (Start from least recently used range.)
         struct demux_cached_range *range = in->ranges[0];
         double earliest_ts = MP_NOPTS_VALUE;
@@ -2452,6 +2816,32 @@ static void execute_seek(struct demux_internal *in)
     in->seeking_in_progress = MP_NOPTS_VALUE;
 }
 
+// Identity of the media for the persistent disk cache. Returns NULL if the
+// source can't be identified. Local files must be regular files, and their
+// modification time is part of the key. Other streams are identified by what
+// the protocol provides, which is URL, size and MIME type; FFmpeg's protocols
+// don't expose validators like ETag, so a replaced file of the same size is
+// not detected.
+static char *get_cache_key(struct demux_internal *in)
+{
+    struct stream *s = in->d_thread->stream;
+    int64_t size = s ? stream_get_size(s) : -1;
+    if (!s || !s->url || size < 0)
+        return NULL;
+
+    int64_t mtime = -1;
+    if (s->is_local_fs) {
+        struct stat st;
+        if (!s->path || stat(s->path, &st) || !S_ISREG(st.st_mode))
+            return NULL;
+        mtime = st.st_mtime;
+    }
+
+    return talloc_asprintf(NULL, "%s|%s|%"PRId64"|%"PRId64"|%s",
+                           in->d_thread->desc->name, s->url, size, mtime,
+                           s->mime_type ? s->mime_type : "");
+}
+
 static void update_opts(struct demuxer *demuxer)
 {
     struct demux_opts *opts = demuxer->opts;
@@ -2487,10 +2877,17 @@ static void update_opts(struct demuxer *demuxer)
         in->using_network_cache_opts = false;
     }
 
-    if (in->seekable_cache && opts->disk_cache && !in->cache) {
-        in->cache = demux_cache_create(in->global, in->log);
-        if (!in->cache)
+    if (in->seekable_cache && (opts->disk_cache || opts->cache_spill) &&
+        !in->cache)
+    {
+        char *key = get_cache_key(in);
+        in->cache = demux_cache_create(in->global, in->log, key);
+        talloc_free(key);
+        if (!in->cache) {
             MP_ERR(in, "Failed to create file cache.\n");
+        } else if (demux_cache_is_persistent(in->cache)) {
+            in->cache_index = demux_cache_read_index(in->cache);
+        }
     }
 
     // The filename option really decides whether recording should be active.
@@ -2604,6 +3001,7 @@ static struct demux_packet *read_packet_from_cache(struct demux_internal *in,
 
     if (pkt->is_cached) {
         assert(in->cache);
+        in->file_cache_reads += 1;
         struct demux_packet *meta = pkt;
         pkt = demux_cache_read(in->cache, pkt->cached_data.pos);
         if (pkt) {
@@ -2612,6 +3010,7 @@ static struct demux_packet *read_packet_from_cache(struct demux_internal *in,
             MP_ERR(in, "Failed to retrieve packet from cache.\n");
         }
     } else {
+        in->mem_cache_reads += 1;
         // The returned packet is mutated etc. and will be owned by the user.
         pkt = demux_copy_packet(pkt);
     }
@@ -3292,6 +3691,7 @@ static struct demuxer *open_given_type(struct mpv_global *global,
         .events = DEMUX_EVENT_ALL,
         .duration = -1,
     };
+    demuxer->packet_pool = demux_packet_pool_alloc(demuxer);
 
     struct demux_internal *in = demuxer->in = talloc_ptrtype(demuxer, in);
     *in = (struct demux_internal){
@@ -3826,6 +4226,8 @@ static bool queue_seek(struct demux_internal *in, double seek_pts, int flags,
     bool block = flags & SEEK_BLOCK;
     flags &= ~(unsigned)SEEK_BLOCK;
 
+    restore_cache_index(in);
+
     struct demux_cached_range *cache_target =
         find_cache_seek_range(in, seek_pts, flags);
 
@@ -4526,6 +4928,9 @@ void demux_get_reader_state(struct demuxer *demuxer, struct demux_reader_state *
         .bytes_per_second = in->bytes_per_second,
         .byte_level_seeks = in->byte_level_seeks,
         .file_cache_bytes = in->cache ? demux_cache_get_size(in->cache) : -1,
+        .file_cache_spilled = in->spilled_bytes,
+        .mem_cache_reads = in->mem_cache_reads,
+        .file_cache_reads = in->file_cache_reads,
     };
     bool any_packets = false;
     for (int n = 0; n < STREAM_TYPE_COUNT; n++) {
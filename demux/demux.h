@@ -50,6 +50,9 @@ struct demux_reader_state {
     int64_t total_bytes;
     int64_t fw_bytes;
     int64_t file_cache_bytes;
+    uint64_t file_cache_spilled; // packet bytes moved from memory to file cache
+    uint64_t mem_cache_reads;   // packets returned from memory
+    uint64_t file_cache_reads;  // packets returned from file cache
     double seeking; // current low level seek target, or NOPTS
     int low_level_seeks; // number of started low level seeks
     uint64_t byte_level_seeks; // number of byte stream level seeks
@@ -66,6 +69,7 @@ extern const struct m_sub_options demux_conf;
 struct demux_opts {
     int enable_cache;
     bool disk_cache;
+    bool cache_spill;
     int64_t max_bytes;
     int64_t max_bytes_bw;
     bool donate_fw;
@@ -263,6 +267,8 @@ typedef struct demuxer {
     struct mp_tags *metadata;
 
     void *priv;   // demuxer-specific internal data
+    // For allocating small packets with new_demux_packet_pooled().
+    struct demux_packet_pool *packet_pool;
     struct mpv_global *global;
     struct mp_log *log, *glog;
     struct demuxer_params *params;
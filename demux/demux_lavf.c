@@ -231,6 +231,8 @@ typedef struct lavf_priv {
     int avif_flags;
     AVFormatContext *avfc;
     AVIOContext *pb;
+    bstr direct_data;       // stream contents, if they're all in memory
+    int64_t direct_pos;
     struct stream_info **streams; // NULL for unknown streams
     int num_streams;
     char *mime_type;
@@ -303,6 +305,44 @@ static int mp_read(void *opaque, uint8_t *buf, int size)
     return ret ? ret : AVERROR_EOF;
 }
 
+// Used instead of mp_read() if the stream is entirely in memory. This avoids
+// copying the data through the stream buffer.
+static int mp_read_direct(void *opaque, uint8_t *buf, int size)
+{
+    struct demuxer *demuxer = opaque;
+    lavf_priv_t *priv = demuxer->priv;
+    if (!priv->stream || priv->direct_pos >= priv->direct_data.len)
+        return AVERROR_EOF;
+
+    size = MPMIN(size, priv->direct_data.len - priv->direct_pos);
+    memcpy(buf, priv->direct_data.start + priv->direct_pos, size);
+    priv->direct_pos += size;
+    return size;
+}
+
+static int64_t mp_seek_direct(void *opaque, int64_t pos, int whence)
+{
+    struct demuxer *demuxer = opaque;
+    lavf_priv_t *priv = demuxer->priv;
+    int64_t size = priv->direct_data.len;
+
+    if (whence == AVSEEK_SIZE)
+        return size;
+    if (whence == SEEK_END) {
+        pos += size;
+    } else if (whence == SEEK_CUR) {
+        pos += priv->direct_pos;
+    } else if (whence != SEEK_SET) {
+        return -1;
+    }
+
+    if (pos < 0 || pos > size)
+        return -1;
+
+    priv->direct_pos = pos;
+    return pos;
+}
+
 static int64_t mp_seek(void *opaque, int64_t pos, int whence)
 {
     struct demuxer *demuxer = opaque;
@@ -1008,8 +1048,15 @@ static int demux_open_lavf(demuxer_t *demuxer, enum demux_check check)
         void *buffer = av_malloc(lavfdopts->buffersize);
         if (!buffer)
             goto fail;
-        priv->pb = avio_alloc_context(buffer, lavfdopts->buffersize, 0,
-                                      demuxer, mp_read, NULL, mp_seek);
+        bool direct = stream_control(priv->stream, STREAM_CTRL_GET_DIRECT_DATA,
+                                     &priv->direct_data) == STREAM_OK;
+        if (direct) {
+            MP_VERBOSE(demuxer, "Reading directly from memory.\n");
+            priv->direct_pos = stream_tell(priv->stream);
+        }
+        priv->pb = avio_alloc_context(buffer, lavfdopts->buffersize, 0, demuxer,
+                                      direct ? mp_read_direct : mp_read, NULL,
+                                      direct ? mp_seek_direct : mp_seek);
         if (!priv->pb) {
             av_free(buffer);
             goto fail;
@@ -27,11 +27,13 @@
 #include <stdbool.h>
 #include <math.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 #include <libavutil/common.h>
 #include <libavutil/dovi_meta.h>
 #include <libavutil/lzo.h>
 #include <libavutil/intreadwrite.h>
+#include <libavutil/md5.h>
 #include <libavutil/avstring.h>
 
 #include <libavcodec/avcodec.h>
@@ -51,9 +53,13 @@
 #include "options/m_option.h"
 #include "options/options.h"
 #include "misc/bstr.h"
+#include "misc/io_utils.h"
+#include "misc/path_utils.h"
+#include "osdep/io.h"
 #include "stream/stream.h"
 #include "video/csputils.h"
 #include "video/mp_image.h"
+#include "cache.h"
 #include "demux.h"
 #include "stheader.h"
 #include "ebml.h"
@@ -197,6 +203,11 @@ typedef struct mkv_demuxer {
     mkv_index_t *indexes;
     size_t num_indexes;
     bool index_complete;
+    bool cues_discarded;
+
+    // Index cache file (see load_index_cache())
+    bool index_cache_loaded;
+    size_t num_cached_indexes;
 
     int edition_id;
 
@@ -235,6 +246,7 @@ struct demux_mkv_opts {
     double subtitle_preroll_secs_index;
     int probe_duration;
     bool probe_start_time;
+    bool index_cache;
 };
 
 const struct m_sub_options demux_mkv_conf = {
@@ -248,6 +260,7 @@ const struct m_sub_options demux_mkv_conf = {
         {"probe-video-duration", OPT_CHOICE(probe_duration,
             {"no", 0}, {"yes", 1}, {"full", 2})},
         {"probe-start-time", OPT_BOOL(probe_start_time)},
+        {"index-cache", OPT_BOOL(index_cache)},
         {0}
     },
     .size = sizeof(struct demux_mkv_opts),
@@ -1067,8 +1080,10 @@ static int demux_mkv_read_cues(demuxer_t *demuxer)
     mkv_d->index_complete = true;
 
 done:
-    if (!mkv_d->index_complete)
+    if (!mkv_d->index_complete) {
         MP_WARN(demuxer, "Discarding potentially broken or useless index.\n");
+        mkv_d->cues_discarded = true;
+    }
     talloc_free(parse_ctx.talloc_ctx);
     return 0;
 }
@@ -2629,8 +2644,9 @@ static bool handle_realaudio(demuxer_t *demuxer, mkv_track_t *track,
             goto error;
         // Release all the audio packets
         for (int x = 0; x < sph * w / apk_usize; x++) {
-            dp = new_demux_packet_from(track->audio_buf + x * apk_usize,
-                                        apk_usize);
+            dp = new_demux_packet_from_pooled(demuxer->packet_pool,
+                                              track->audio_buf + x * apk_usize,
+                                              apk_usize);
             if (!dp)
                 goto error;
             /* Put timestamp only on packets that correspond to original
@@ -2767,7 +2783,8 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
         int size = dp->len;
         uint8_t *parsed;
         if (libav_parse_wavpack(track, dp->buffer, &parsed, &size) >= 0) {
-            struct demux_packet *new = new_demux_packet_from(parsed, size);
+            struct demux_packet *new =
+                new_demux_packet_from_pooled(demuxer->packet_pool, parsed, size);
             if (new) {
                 demux_packet_copy_attribs(new, dp);
                 talloc_free(dp);
@@ -2825,7 +2842,8 @@ static void mkv_parse_and_add_packet(demuxer_t *demuxer, mkv_track_t *track,
         dp->len -= len;
         dp->pos += len;
         if (size) {
-            struct demux_packet *new = new_demux_packet_from(data, size);
+            struct demux_packet *new =
+                new_demux_packet_from_pooled(demuxer->packet_pool, data, size);
             if (!new)
                 break;
             if (copy_sidedata)
@@ -2999,7 +3017,8 @@ static int handle_block(demuxer_t *demuxer, struct block_info *block_info)
 
             if (block.start != nblock.start || block.len != nblock.len) {
                 // (avoidable copy of the entire data)
-                dp = new_demux_packet_from(nblock.start, nblock.len);
+                dp = new_demux_packet_from_pooled(demuxer->packet_pool,
+                                                  nblock.start, nblock.len);
             } else {
                 dp = new_demux_packet_from_buf(data);
             }
@@ -3275,6 +3294,182 @@ static mkv_index_t *get_highest_index_entry(struct demuxer *demuxer)
     return index;
 }
 
+#define INDEX_CACHE_MAGIC "mpvmkvix"
+#define INDEX_CACHE_VERSION 1
+
+struct index_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t has_durations;
+    uint64_t file_size;
+    int64_t mtime;
+    int64_t segment_start;
+    uint64_t num_entries;
+};
+
+struct index_cache_entry {
+    int64_t tnum;
+    int64_t timecode, duration;
+    uint64_t filepos;
+};
+
+// Return the file name of the index cache for the opened file, and set *hd to
+// the header it must have. Returns NULL if the index cache can't be used.
+static char *get_index_cache_file(struct demuxer *demuxer, void *ta_ctx,
+                                  struct index_cache_header *hd)
+{
+    struct mkv_demuxer *mkv_d = demuxer->priv;
+    struct stream *s = demuxer->stream;
+
+    if (!mkv_d->opts || !mkv_d->opts->index_cache ||
+        demuxer->opts->index_mode != 1 ||
+        !s || !s->is_local_fs || !s->path)
+        return NULL;
+
+    struct stat st;
+    if (stat(s->path, &st) || !S_ISREG(st.st_mode))
+        return NULL;
+
+    *hd = (struct index_cache_header){
+        .magic = INDEX_CACHE_MAGIC,
+        .version = INDEX_CACHE_VERSION,
+        .file_size = st.st_size,
+        .mtime = st.st_mtime,
+        .segment_start = mkv_d->segment_start,
+    };
+
+    char *dir = demux_cache_get_dir(ta_ctx, demuxer->global);
+    if (!dir)
+        return NULL;
+
+    char *key = talloc_asprintf(ta_ctx, "%s|%"PRIu64"|%"PRId64,
+                                mp_normalize_path(ta_ctx, s->path),
+                                hd->file_size, hd->mtime);
+    uint8_t md5[16];
+    av_md5_sum(md5, key, strlen(key));
+    char *name = talloc_strdup(ta_ctx, "mpv-mkvindex-");
+    for (int i = 0; i < 16; i++)
+        name = talloc_asprintf_append(name, "%02X", md5[i]);
+    name = talloc_strdup_append(name, ".idx");
+
+    return mp_path_join(ta_ctx, dir, name);
+}
+
+// Load the index built by a previous run over a file without usable cues. The
+// loaded entries act like an incrementally built index, so indexing continues
+// where the previous run stopped.
+static void load_index_cache(struct demuxer *demuxer)
+{
+    struct mkv_demuxer *mkv_d = demuxer->priv;
+    void *tmp = talloc_new(NULL);
+
+    mkv_d->index_cache_loaded = true;
+
+    struct index_cache_header hd, ref;
+    char *filename = get_index_cache_file(demuxer, tmp, &ref);
+    FILE *f = filename ? fopen(filename, "rb") : NULL;
+    if (!f)
+        goto done;
+
+    // The entries must fill the rest of the file exactly, so a corrupt count
+    // can't cause a huge allocation.
+    struct stat st;
+    if (fstat(fileno(f), &st) || st.st_size < sizeof(hd) ||
+        fread(&hd, sizeof(hd), 1, f) != 1 ||
+        memcmp(hd.magic, ref.magic, sizeof(hd.magic)) ||
+        hd.version != ref.version || hd.file_size != ref.file_size ||
+        hd.mtime != ref.mtime || hd.segment_start != ref.segment_start ||
+        (st.st_size - sizeof(hd)) % sizeof(struct index_cache_entry) ||
+        hd.num_entries != (st.st_size - sizeof(hd)) /
+                          sizeof(struct index_cache_entry) ||
+        hd.num_entries <= mkv_d->num_indexes)
+        goto done;
+
+    struct index_cache_entry *entries =
+        talloc_array(tmp, struct index_cache_entry, hd.num_entries);
+    if (fread(entries, sizeof(entries[0]), hd.num_entries, f) != hd.num_entries)
+        goto done;
+
+    mkv_d->num_indexes = 0;
+    for (int n = 0; n < mkv_d->num_tracks; n++)
+        mkv_d->tracks[n]->last_index_entry = (size_t)-1;
+
+    for (uint64_t i = 0; i < hd.num_entries; i++) {
+        struct index_cache_entry *e = &entries[i];
+        struct mkv_track *track = NULL;
+        for (int n = 0; n < mkv_d->num_tracks; n++) {
+            if (mkv_d->tracks[n]->tnum == e->tnum)
+                track = mkv_d->tracks[n];
+        }
+        if (!track || e->filepos >= hd.file_size)
+            continue;
+        cue_index_add(demuxer, e->tnum, e->filepos, e->timecode, e->duration);
+        track->last_index_entry = mkv_d->num_indexes - 1;
+    }
+    mkv_d->index_has_durations = hd.has_durations;
+    mkv_d->num_cached_indexes = mkv_d->num_indexes;
+
+    MP_VERBOSE(demuxer, "Loaded %zu index entries from %s\n",
+               mkv_d->num_indexes, filename);
+
+done:
+    if (f)
+        fclose(f);
+    talloc_free(tmp);
+}
+
+// Store an index that was built by reading the file, if it grew since it was
+// loaded from the cache (or if there was none).
+static void save_index_cache(struct demuxer *demuxer)
+{
+    struct mkv_demuxer *mkv_d = demuxer->priv;
+
+    if (mkv_d->index_complete || mkv_d->num_indexes <= mkv_d->num_cached_indexes)
+        return;
+
+    // Files with cues don't need this. They might just not have been read yet.
+    if (!mkv_d->cues_discarded) {
+        for (int n = 0; n < mkv_d->num_headers; n++) {
+            if (mkv_d->headers[n].id == MATROSKA_ID_CUES)
+                return;
+        }
+    }
+
+    void *tmp = talloc_new(NULL);
+
+    struct index_cache_header hd;
+    char *filename = get_index_cache_file(demuxer, tmp, &hd);
+    if (!filename)
+        goto done;
+
+    hd.has_durations = mkv_d->index_has_durations;
+    hd.num_entries = mkv_d->num_indexes;
+
+    size_t size = sizeof(hd) + hd.num_entries * sizeof(struct index_cache_entry);
+    char *data = talloc_size(tmp, size);
+    memcpy(data, &hd, sizeof(hd));
+    struct index_cache_entry *entries = (void *)(data + sizeof(hd));
+    for (size_t i = 0; i < mkv_d->num_indexes; i++) {
+        mkv_index_t *index = &mkv_d->indexes[i];
+        entries[i] = (struct index_cache_entry){
+            .tnum = index->tnum,
+            .timecode = index->timecode,
+            .duration = index->duration,
+            .filepos = index->filepos,
+        };
+    }
+
+    if (mp_save_to_file(filename, data, size)) {
+        MP_VERBOSE(demuxer, "Saved %zu index entries to %s\n",
+                   mkv_d->num_indexes, filename);
+    } else {
+        MP_WARN(demuxer, "Failed to write index cache %s\n", filename);
+    }
+
+done:
+    talloc_free(tmp);
+}
+
 static int create_index_until(struct demuxer *demuxer, int64_t timecode)
 {
     struct mkv_demuxer *mkv_d = demuxer->priv;
@@ -3285,6 +3480,9 @@ static int create_index_until(struct demuxer *demuxer, int64_t timecode)
     if (mkv_d->index_complete)
         return 0;
 
+    if (!mkv_d->index_cache_loaded)
+        load_index_cache(demuxer);
+
     mkv_index_t *index = get_highest_index_entry(demuxer);
 
     if (!index || index->timecode * mkv_d->tc_scale < timecode) {
@@ -3572,6 +3770,7 @@ static void mkv_free(struct demuxer *demuxer)
     struct mkv_demuxer *mkv_d = demuxer->priv;
     if (!mkv_d)
         return;
+    save_index_cache(demuxer);
     mkv_seek_reset(demuxer);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
@@ -19,8 +19,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
 #include <libavutil/hdr_dynamic_metadata.h>
 #include <libavutil/intreadwrite.h>
 
@@ -140,6 +142,86 @@ struct demux_packet *new_demux_packet(size_t len)
     return dp;
 }
 
+// Payload size classes of struct demux_packet_pool: 64, 128, ... 4096 bytes.
+#define POOL_MIN_SHIFT 6
+#define POOL_NUM_CLASSES 7
+
+struct demux_packet_pool {
+    // Created on first use, so unused size classes cost nothing.
+    _Atomic(AVBufferPool *) pools[POOL_NUM_CLASSES];
+};
+
+static void packet_pool_destroy(void *ptr)
+{
+    struct demux_packet_pool *pool = ptr;
+    // Buffers still referenced by packets keep the AVBufferPool alive.
+    for (int n = 0; n < POOL_NUM_CLASSES; n++) {
+        AVBufferPool *p = atomic_load(&pool->pools[n]);
+        av_buffer_pool_uninit(&p);
+    }
+}
+
+// Create a pool for small packet payloads. Allocating small packets from it
+// avoids a malloc/free pair per packet, which matters for audio and
+// subtitle streams that produce huge numbers of tiny packets. Thread-safe.
+struct demux_packet_pool *demux_packet_pool_alloc(void *ta_parent)
+{
+    struct demux_packet_pool *pool = talloc_zero(ta_parent, struct demux_packet_pool);
+    talloc_set_destructor(pool, packet_pool_destroy);
+    return pool;
+}
+
+static AVBufferPool *get_class_pool(struct demux_packet_pool *pool, int cls)
+{
+    AVBufferPool *p = atomic_load(&pool->pools[cls]);
+    if (!p) {
+        size_t size = (1 << (POOL_MIN_SHIFT + cls)) + AV_INPUT_BUFFER_PADDING_SIZE;
+        AVBufferPool *new = av_buffer_pool_init(size, NULL);
+        MP_HANDLE_OOM(new);
+        // Another thread may have created it in the meantime.
+        if (atomic_compare_exchange_strong(&pool->pools[cls], &p, new)) {
+            p = new;
+        } else {
+            av_buffer_pool_uninit(&new);
+        }
+    }
+    return p;
+}
+
+// Like new_demux_packet(), but use pool for the payload if it's small enough.
+// pool can be NULL, in which case this is exactly new_demux_packet().
+struct demux_packet *new_demux_packet_pooled(struct demux_packet_pool *pool,
+                                             size_t len)
+{
+    int cls = 0;
+    while (cls < POOL_NUM_CLASSES && len > (1 << (POOL_MIN_SHIFT + cls)))
+        cls++;
+    if (!pool || cls == POOL_NUM_CLASSES)
+        return new_demux_packet(len);
+
+    AVBufferRef *buf = av_buffer_pool_get(get_class_pool(pool, cls));
+    if (!buf)
+        return NULL;
+    struct demux_packet *dp = packet_create();
+    dp->avpacket->buf = buf;
+    dp->avpacket->data = dp->buffer = buf->data;
+    dp->avpacket->size = dp->len = len;
+    dp->pooled = true;
+    memset(dp->buffer + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return dp;
+}
+
+// Like new_demux_packet_from(), but see new_demux_packet_pooled().
+struct demux_packet *new_demux_packet_from_pooled(struct demux_packet_pool *pool,
+                                                  void *data, size_t len)
+{
+    struct demux_packet *dp = new_demux_packet_pooled(pool, len);
+    if (!dp)
+        return NULL;
+    memcpy(dp->buffer, data, len);
+    return dp;
+}
+
 void demux_packet_shorten(struct demux_packet *dp, size_t len)
 {
     assert(len <= dp->len);
@@ -175,6 +257,8 @@ struct demux_packet *demux_copy_packet(struct demux_packet *dp)
     struct demux_packet *new = NULL;
     if (dp->avpacket) {
         new = new_demux_packet_from_avpacket(dp->avpacket);
+        if (new)
+            new->pooled = dp->pooled;
     } else {
         // Some packets might be not created by new_demux_packet*().
         new = new_demux_packet_from(dp->buffer, dp->len);
@@ -202,7 +286,12 @@ size_t demux_packet_estimate_total_size(struct demux_packet *dp)
     size += 10 * sizeof(void *); // additional estimate for ta_ext_header
     if (dp->avpacket) {
         assert(!dp->is_cached);
-        size += ROUND_ALLOC(dp->len);
+        // Pooled payloads occupy their whole size class. (Not done for other
+        // packets, whose buffer may be shared with unrelated data.)
+        size_t payload = dp->len;
+        if (dp->pooled && dp->avpacket->buf)
+            payload = dp->avpacket->buf->size - AV_INPUT_BUFFER_PADDING_SIZE;
+        size += ROUND_ALLOC(payload + AV_INPUT_BUFFER_PADDING_SIZE);
         size += ROUND_ALLOC(sizeof(AVPacket));
         size += 8 * sizeof(void *); // ta  overhead
         size += ROUND_ALLOC(sizeof(AVBufferRef));
@@ -53,6 +53,9 @@ typedef struct demux_packet {
     // If true, cached_data is valid, while buffer/len are not.
     bool is_cached : 1;
 
+    // Payload was allocated from a demux_packet_pool.
+    bool pooled : 1;
+
     // segmentation (ordered chapters, EDL)
     bool segmented;
     struct mp_codec_params *codec;  // set to non-NULL iff segmented is set
@@ -71,11 +74,17 @@ typedef struct demux_packet {
 } demux_packet_t;
 
 struct AVBufferRef;
+struct demux_packet_pool;
 
 struct demux_packet *new_demux_packet(size_t len);
 struct demux_packet *new_demux_packet_from_avpacket(struct AVPacket *avpkt);
 struct demux_packet *new_demux_packet_from(void *data, size_t len);
 struct demux_packet *new_demux_packet_from_buf(struct AVBufferRef *buf);
+struct demux_packet_pool *demux_packet_pool_alloc(void *ta_parent);
+struct demux_packet *new_demux_packet_pooled(struct demux_packet_pool *pool,
+                                             size_t len);
+struct demux_packet *new_demux_packet_from_pooled(struct demux_packet_pool *pool,
+                                                  void *data, size_t len);
 void demux_packet_shorten(struct demux_packet *dp, size_t len);
 void free_demux_packet(struct demux_packet *dp);
 struct demux_packet *demux_copy_packet(struct demux_packet *dp);
@@ -179,7 +179,7 @@ struct mp_thread_pool *mp_thread_pool_create(void *ta_parent, int init_threads,
 }
 
 static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
-                            void *fn_ctx, bool allow_queue)
+                            void *fn_ctx, bool allow_queue, bool need_idle)
 {
     bool ok = true;
 
@@ -201,6 +201,10 @@ static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
         }
     }
 
+    // No thread is free to pick it up, so it would wait behind other work.
+    if (need_idle && pool->busy_threads + pool->num_work >= pool->num_threads)
+        ok = false;
+
     if (ok) {
         MP_TARRAY_INSERT_AT(pool, pool->work, pool->num_work, 0, work);
         mp_cond_signal(&pool->wakeup);
@@ -213,11 +217,17 @@ static bool thread_pool_add(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                           void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, true);
+    return thread_pool_add(pool, fn, fn_ctx, true, false);
 }
 
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx)
 {
-    return thread_pool_add(pool, fn, fn_ctx, false);
+    return thread_pool_add(pool, fn, fn_ctx, false, false);
+}
+
+bool mp_thread_pool_try_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
+                            void *fn_ctx)
+{
+    return thread_pool_add(pool, fn, fn_ctx, false, true);
 }
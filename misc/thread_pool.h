@@ -32,4 +32,10 @@ bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx);
 
+// Like mp_thread_pool_run(), but fail instead of queuing the item if all threads
+// are busy and no new thread can be created. Note that threads which just
+// finished an item may still count as busy for a moment.
+bool mp_thread_pool_try_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
+                            void *fn_ctx);
+
 #endif
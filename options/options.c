@@ -141,6 +141,8 @@ static const m_option_t mp_vo_opt_list[] = {
     {"focus-on", OPT_CHOICE(focus_on, {"never", 0}, {"open", 1}, {"all", 2})},
     {"force-render", OPT_BOOL(force_render)},
     {"force-window-position", OPT_BOOL(force_window_position)},
+    {"libmpv-sw-threads", OPT_CHOICE(libmpv_sw_threads, {"auto", 0}),
+        M_RANGE(1, 64)},
     {"x11-name", OPT_STRING(winname)},
     {"wayland-app-id", OPT_STRING(appid)},
     {"monitoraspect", OPT_FLOAT(force_monitor_aspect), M_RANGE(0.0, 9.0)},
@@ -260,6 +262,7 @@ const struct m_sub_options vo_sub_opts = {
         .keepaspect = true,
         .keepaspect_window = true,
         .native_fs = true,
+        .libmpv_sw_threads = 1,
         .input_ime = true,
         .taskbar_progress = true,
         .show_in_taskbar = true,
@@ -782,6 +785,9 @@ static const m_option_t mp_opts[] = {
         {"decoder", 2},
         {"decoder+vo", 3})},
     {"video-latency-hacks", OPT_BOOL(video_latency_hacks)},
+    {"image-pool-max-bytes", OPT_BYTE_SIZE(image_pool_max_bytes),
+        M_RANGE(0, M_MAX_MEM_BYTES)},
+    {"image-pool-hugepages", OPT_BOOL(image_pool_hugepages)},
 
     {"untimed", OPT_BOOL(untimed)},
 
@@ -878,6 +884,7 @@ static const m_option_t mp_opts[] = {
         .flags = M_OPT_FILE},
     {"screenshot-directory", OPT_ALIAS("screenshot-dir")},
     {"screenshot-sw", OPT_BOOL(screenshot_sw)},
+    {"screenshot-queue-size", OPT_INT(screenshot_queue_size), M_RANGE(1, 64)},
 
     {"", OPT_SUBSTRUCT(resample_opts, resample_conf)},
 
@@ -1031,6 +1038,7 @@ static const struct MPOpts mp_default_opts = {
     .audiofile_auto = -1,
     .osd_bar_visible = true,
     .screenshot_template = "mpv-shot%n",
+    .screenshot_queue_size = 4,
     .play_dir = 1,
     .media_controls = true,
     .video_exts = (char *[]){
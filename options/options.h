@@ -73,6 +73,7 @@ typedef struct mp_vo_opts {
     float monitor_pixel_aspect;
     bool force_render;
     bool force_window_position;
+    int libmpv_sw_threads;
 
     int backdrop_type;
     int window_affinity;
@@ -246,6 +247,8 @@ typedef struct MPOpts {
     int autosync;
     int frame_dropping;
     bool video_latency_hacks;
+    int64_t image_pool_max_bytes;
+    bool image_pool_hugepages;
     int term_osd;
     bool term_osd_bar;
     char *term_osd_bar_chars;
@@ -311,6 +314,7 @@ typedef struct MPOpts {
     char *screenshot_template;
     char *screenshot_dir;
     bool screenshot_sw;
+    int screenshot_queue_size;
 
     struct m_channels audio_output_channels;
     int audio_output_format;
@@ -1546,8 +1546,12 @@ static int mp_property_demuxer_cache_state(void *ctx, struct m_property *prop,
     node_map_add_flag(r, "idle", s.idle);
     node_map_add_int64(r, "total-bytes", s.total_bytes);
     node_map_add_int64(r, "fw-bytes", s.fw_bytes);
-    if (s.file_cache_bytes >= 0)
+    if (s.file_cache_bytes >= 0) {
         node_map_add_int64(r, "file-cache-bytes", s.file_cache_bytes);
+        node_map_add_int64(r, "file-cache-spilled-bytes", s.file_cache_spilled);
+        node_map_add_int64(r, "file-cache-reads", s.file_cache_reads);
+        node_map_add_int64(r, "memory-cache-reads", s.mem_cache_reads);
+    }
     if (s.bytes_per_second > 0)
         node_map_add_int64(r, "raw-input-rate", s.bytes_per_second);
     if (s.seeking != MP_NOPTS_VALUE)
@@ -1850,6 +1854,15 @@ static int mp_property_ao(void *ctx, struct m_property *p, int action, void *arg
     return m_property_strdup_ro(action, arg, mpctx->ao ? ao_get_name(mpctx->ao) : NULL);
 }
 
+static int mp_property_ao_underruns(void *ctx, struct m_property *prop,
+                                    int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->ao)
+        return M_PROPERTY_UNAVAILABLE;
+    return m_property_int64_ro(action, arg, ao_get_underruns(mpctx->ao));
+}
+
 /// Audio delay (RW)
 static int mp_property_audio_delay(void *ctx, struct m_property *prop,
                                    int action, void *arg)
@@ -4293,6 +4306,7 @@ static const struct m_property mp_properties_base[] = {
     {"volume-gain", mp_property_volume_gain},
     {"ao-volume", mp_property_ao_volume},
     {"ao-mute", mp_property_ao_mute},
+    {"ao-underruns", mp_property_ao_underruns},
     {"audio-delay", mp_property_audio_delay},
     M_PROPERTY_ALIAS("audio-codec-name", "current-tracks/audio/codec"),
     M_PROPERTY_ALIAS("audio-codec", "current-tracks/audio/codec-desc"),
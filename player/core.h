@@ -241,6 +241,8 @@ typedef struct MPContext {
     struct MPOpts *opts;
     struct mp_log *log;
     struct stats_ctx *stats;
+    struct stats_ctx *image_pool_stats;
+    struct stats_ctx *audio_pool_stats;
     struct m_config *mconfig;
     struct input_ctx *input;
     struct mp_client_api *clients;
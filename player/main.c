@@ -174,6 +174,8 @@ void mp_destroy(struct MPContext *mpctx)
     mp_uninit_ipc(mpctx->ipc_ctx);
     mpctx->ipc_ctx = NULL;
 
+    screenshot_uninit(mpctx);
+
     uninit_audio_out(mpctx);
     uninit_video_out(mpctx);
 
@@ -292,6 +294,8 @@ struct MPContext *mp_create(void)
     mpctx->statusline = mp_log_new(mpctx, mpctx->log, "!statusline");
 
     mpctx->stats = stats_ctx_create(mpctx, mpctx->global, "main");
+    mpctx->image_pool_stats = stats_ctx_create(mpctx, mpctx->global, "image-pool");
+    mpctx->audio_pool_stats = stats_ctx_create(mpctx, mpctx->global, "audio-pool");
 
     // Create the config context and register the options
     mpctx->mconfig = m_config_new(mpctx, mpctx->log, &mp_opt_root);
@@ -27,6 +27,7 @@
 #include "mpv_talloc.h"
 #include "screenshot.h"
 
+#include "audio/aframe.h"
 #include "audio/out/ao.h"
 #include "common/common.h"
 #include "common/encode.h"
@@ -46,6 +47,7 @@
 #include "stream/stream.h"
 #include "sub/dec_sub.h"
 #include "sub/osd.h"
+#include "video/mp_image_pool.h"
 #include "video/out/vo.h"
 
 // Wait until mp_wakeup_core() is called, since the last time
@@ -1224,6 +1226,14 @@ static void handle_eof(struct MPContext *mpctx)
     }
 }
 
+static void handle_frame_pools(struct MPContext *mpctx)
+{
+    mp_image_pool_set_max_bytes(mpctx->opts->image_pool_max_bytes);
+    mp_image_pool_set_hugepages(mpctx->opts->image_pool_hugepages);
+    mp_image_pool_report_stats(mpctx->image_pool_stats);
+    mp_aframe_pool_report_stats(mpctx->audio_pool_stats);
+}
+
 static void handle_clipboard_updates(struct MPContext *mpctx)
 {
     if (mp_clipboard_data_changed(mpctx->clipboard))
@@ -1257,6 +1267,8 @@ void run_playloop(struct MPContext *mpctx)
 
     handle_clipboard_updates(mpctx);
 
+    handle_frame_pools(mpctx);
+
     update_osd_msg(mpctx);
 
     handle_update_subtitles(mpctx);
@@ -25,12 +25,14 @@
 
 #include "mpv_talloc.h"
 #include "screenshot.h"
+#include "client.h"
 #include "core.h"
 #include "command.h"
 #include "input/cmd.h"
 #include "misc/bstr.h"
 #include "misc/dispatch.h"
 #include "misc/node.h"
+#include "misc/thread_pool.h"
 #include "misc/thread_tools.h"
 #include "common/msg.h"
 #include "options/path.h"
@@ -55,8 +57,22 @@ typedef struct screenshot_ctx {
 
     int frameno;
     uint64_t last_frame_count;
+
+    // Screenshots written in the background (each-frame mode).
+    struct mp_thread_pool *encode_pool;
+    struct screenshot_job **jobs;
+    int num_jobs;
 } screenshot_ctx;
 
+struct screenshot_job {
+    struct MPContext *mpctx;
+    struct mp_image *image;
+    struct image_writer_opts *opts;
+    char *filename;
+    bool ok;
+    atomic_bool done;
+};
+
 void screenshot_init(struct MPContext *mpctx)
 {
     mpctx->screenshot_ctx = talloc(mpctx, screenshot_ctx);
@@ -75,6 +91,14 @@ static char *stripext(void *talloc_ctx, const char *s)
     return talloc_asprintf(talloc_ctx, "%.*s", (int)(end - s), s);
 }
 
+// Let clients know that a screenshot file was finished.
+static void notify_written(struct MPContext *mpctx, const char *filename)
+{
+    const char *args[] = {"screenshot-written", filename};
+    mpv_event_client_message event = {.args = args, .num_args = 2};
+    mp_client_broadcast_event(mpctx, MPV_EVENT_CLIENT_MESSAGE, &event);
+}
+
 static bool write_screenshot(struct mp_cmd_ctx *cmd, struct mp_image *img,
                              const char *filename, struct image_writer_opts *opts,
                              bool overwrite)
@@ -94,12 +118,85 @@ static bool write_screenshot(struct mp_cmd_ctx *cmd, struct mp_image *img,
 
     if (ok) {
         mp_cmd_msg(cmd, MSGL_INFO, "Screenshot: '%s'", filename);
+        notify_written(mpctx, filename);
     } else {
         mp_cmd_msg(cmd, MSGL_ERR, "Error writing screenshot!");
     }
     return ok;
 }
 
+static void write_job(void *p)
+{
+    struct screenshot_job *job = p;
+    struct MPContext *mpctx = job->mpctx;
+
+    job->ok = write_image(job->image, job->opts, job->filename, mpctx->global,
+                          mpctx->screenshot_ctx->log, false);
+
+    atomic_store(&job->done, true);
+    mp_wakeup_core(mpctx);
+}
+
+// Report and free screenshots that were written by the encode pool.
+static void collect_jobs(struct MPContext *mpctx)
+{
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+
+    for (int n = 0; n < ctx->num_jobs;) {
+        struct screenshot_job *job = ctx->jobs[n];
+        if (!atomic_load(&job->done)) {
+            n++;
+            continue;
+        }
+
+        if (job->ok) {
+            MP_INFO(ctx, "Screenshot: '%s'\n", job->filename);
+            notify_written(mpctx, job->filename);
+        } else {
+            MP_ERR(ctx, "Error writing screenshot '%s'!\n", job->filename);
+        }
+        talloc_free(job);
+        MP_TARRAY_REMOVE_AT(ctx->jobs, ctx->num_jobs, n);
+    }
+}
+
+// Write the screenshot in the background. Takes ownership of img.
+static bool queue_screenshot(struct mp_cmd_ctx *cmd, struct mp_image *img,
+                             const char *filename)
+{
+    struct MPContext *mpctx = cmd->mpctx;
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+
+    if (!ctx->encode_pool)
+        ctx->encode_pool = mp_thread_pool_create(ctx, 1, 1, 64);
+    if (!ctx->encode_pool) {
+        bool ok = write_screenshot(cmd, img, filename, NULL, false);
+        talloc_free(img);
+        return ok;
+    }
+
+    mp_cmd_msg(cmd, MSGL_V, "Queuing screenshot: '%s'", filename);
+
+    struct screenshot_job *job = talloc_zero(NULL, struct screenshot_job);
+    job->mpctx = mpctx;
+    job->image = talloc_steal(job, img);
+    job->opts = image_writer_opts_dup(job, mpctx->opts->screenshot_image_opts);
+    job->filename = talloc_strdup(job, filename);
+    MP_TARRAY_APPEND(ctx, ctx->jobs, ctx->num_jobs, job);
+
+    mp_thread_pool_queue(ctx->encode_pool, write_job, job);
+    return true;
+}
+
+static bool is_queued(screenshot_ctx *ctx, const char *filename)
+{
+    for (int n = 0; n < ctx->num_jobs; n++) {
+        if (strcmp(ctx->jobs[n]->filename, filename) == 0)
+            return true;
+    }
+    return false;
+}
+
 #ifdef _WIN32
 #define ILLEGAL_FILENAME_CHARS "?\"/\\<>*|:"
 #else
@@ -310,7 +407,7 @@ static char *gen_fname(struct mp_cmd_ctx *cmd, const char *file_ext)
             mp_mkdirp(full_dir);
         }
 
-        if (!mp_path_exists(fname))
+        if (!mp_path_exists(fname) && !is_queued(ctx, fname))
             return fname;
 
         if (sequence == prev_sequence) {
@@ -538,7 +635,12 @@ void cmd_screenshot(void *p)
     if (image) {
         char *filename = gen_fname(cmd, image_writer_file_ext(opts));
         if (filename) {
-            cmd->success = write_screenshot(cmd, image, filename, NULL, false);
+            if (each_frame_mode) {
+                cmd->success = queue_screenshot(cmd, image, filename);
+                image = NULL;
+            } else {
+                cmd->success = write_screenshot(cmd, image, filename, NULL, false);
+            }
             if (cmd->success) {
                 node_init(res, MPV_FORMAT_NODE_MAP, NULL);
                 node_map_add_string(res, "filename", filename);
@@ -595,10 +697,24 @@ static void screenshot_fin(struct mp_cmd_ctx *cmd)
     mp_wakeup_core(mpctx);
 }
 
+void screenshot_uninit(struct MPContext *mpctx)
+{
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+    if (!ctx)
+        return;
+
+    // Blocks until all queued screenshots are written.
+    TA_FREEP(&ctx->encode_pool);
+    collect_jobs(mpctx);
+    assert(!ctx->num_jobs);
+}
+
 void handle_each_frame_screenshot(struct MPContext *mpctx)
 {
     screenshot_ctx *ctx = mpctx->screenshot_ctx;
 
+    collect_jobs(mpctx);
+
     if (!ctx->each_frame)
         return;
 
@@ -606,12 +722,18 @@ void handle_each_frame_screenshot(struct MPContext *mpctx)
         return;
     ctx->last_frame_count = mpctx->shown_vframes;
 
+    // Block (in a reentrant way) while too many screenshots are being written.
+    // Otherwise, we could pile up screenshots in memory forever.
+    while (ctx->num_jobs >= mpctx->opts->screenshot_queue_size) {
+        mp_idle(mpctx);
+        collect_jobs(mpctx);
+    }
+
     struct mp_waiter wait = MP_WAITER_INITIALIZER;
     void *a[] = {mpctx, &wait};
     run_command(mpctx, mp_cmd_clone(ctx->each_frame), NULL, screenshot_fin, a);
 
-    // Block (in a reentrant way) until the screenshot was written. Otherwise,
-    // we could pile up screenshot requests forever.
+    // Block until the screenshot was taken. It's written in the background.
     while (!mp_waiter_poll(&wait))
         mp_idle(mpctx);
 
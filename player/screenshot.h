@@ -28,6 +28,9 @@ struct mpv_global;
 // One time initialization at program start.
 void screenshot_init(struct MPContext *mpctx);
 
+// Wait until all queued screenshots are written.
+void screenshot_uninit(struct MPContext *mpctx);
+
 // Called by the playback core on each iteration.
 void handle_each_frame_screenshot(struct MPContext *mpctx);
 
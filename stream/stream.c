@@ -103,6 +103,7 @@ static const stream_info_t *const stream_list[] = {
 
 struct stream_opts {
     int64_t buffer_size;
+    int buffer_windows;
     bool load_unsafe_playlists;
 };
 
@@ -112,15 +113,27 @@ const struct m_sub_options stream_conf = {
     .opts = (const struct m_option[]){
         {"stream-buffer-size", OPT_BYTE_SIZE(buffer_size),
             M_RANGE(STREAM_MIN_BUFFER_SIZE, STREAM_MAX_BUFFER_SIZE)},
+        {"stream-buffer-windows", OPT_INT(buffer_windows), M_RANGE(0, 16)},
         {"load-unsafe-playlists", OPT_BOOL(load_unsafe_playlists)},
         {0}
     },
     .size = sizeof(struct stream_opts),
     .defaults = &(const struct stream_opts){
         .buffer_size = 128 * 1024,
+        .buffer_windows = 0,
     },
 };
 
+// A stream buffer that was made inactive by a seek. If a later seek goes back
+// into it, it becomes the current buffer again (see stream_seek()).
+struct stream_window {
+    uint8_t *buffer;
+    unsigned int buffer_mask;
+    unsigned int buf_start, buf_end;    // same as the stream_t fields
+    int64_t pos;                        // stream position of buf_end
+    uint64_t last_use;
+};
+
 // return -1 if not hex char
 static int hex2dec(char c)
 {
@@ -405,6 +418,11 @@ static int stream_create_instance(const stream_info_t *sinfo,
         return STREAM_ERROR;
     }
 
+    if (s->seekable && s->mode == STREAM_READ) {
+        s->max_windows = opts->buffer_windows;
+        s->windows = talloc_zero_array(s, struct stream_window, s->max_windows);
+    }
+
     assert(s->seekable == !!s->seek);
 
     if (s->mime_type)
@@ -485,6 +503,23 @@ stream_t *open_output_stream(const char *filename, struct mpv_global *global)
     return s;
 }
 
+// Seek the backend to pos. If the buffer was switched to a window, s->pos is the
+// end of the window, not the backend's position. Some backends (for example
+// stream_libarchive) use s->pos as their current position when seeking, so
+// it's temporarily set to the real position. s->pos is not changed otherwise.
+static bool backend_seek(stream_t *s, int64_t pos)
+{
+    int64_t logical_pos = s->pos;
+    if (s->need_seek)
+        s->pos = s->backend_pos;
+    bool ok = s->seek(s, pos) > 0;
+    if (ok)
+        s->backend_pos = pos;
+    s->pos = logical_pos;
+    s->need_seek &= !ok;
+    return ok;
+}
+
 // Read function bypassing the local stream buffer. This will not write into
 // s->buffer, but into buf[0..len] instead.
 // Returns 0 on error or EOF, and length of bytes read on success.
@@ -495,6 +530,15 @@ static int stream_read_unbuffered(stream_t *s, void *buf, int len)
     if (len <= 0)
         return 0;
 
+    // The buffer was switched to a window; the real position is elsewhere.
+    if (s->need_seek) {
+        if (!backend_seek(s, s->pos)) {
+            s->eof = 1;
+            return 0;
+        }
+        s->total_stream_seeks++;
+    }
+
     int res = 0;
     // we will retry even if we already reached EOF previously.
     if (s->fill_buffer && !mp_cancel_test(s->cancel))
@@ -581,6 +625,14 @@ static bool stream_read_more(struct stream *s, int forward)
     return !!read;
 }
 
+static void drop_buffer(stream_t *s)
+{
+    s->pos = stream_tell(s);
+    s->buf_start = s->buf_cur = s->buf_end = 0;
+    s->eof = 0;
+    stream_resize_buffer(s, 0, 0);
+}
+
 // Read between 1..buf_size bytes of data, return how much data has been read.
 // Return 0 on EOF, error, or if buf_size was 0.
 int stream_read_partial(stream_t *s, void *buf, int buf_size)
@@ -590,7 +642,7 @@ int stream_read_partial(stream_t *s, void *buf, int buf_size)
     if (s->buf_cur == s->buf_end && buf_size > 0) {
         if (buf_size > (s->buffer_mask + 1) / 2) {
             // Direct read if the buffer is too small anyway.
-            stream_drop_buffers(s);
+            drop_buffer(s);
             return stream_read_unbuffered(s, buf, buf_size);
         }
         stream_read_more(s, 1);
@@ -675,18 +727,102 @@ static bool stream_skip_read(struct stream *s, int64_t len)
 // Drop the internal buffer. Note that this will advance the stream position
 // (as seen by stream_tell()), because the real stream position is ahead of the
 // logical stream position by the amount of buffered but not yet read data.
+// This also discards the inactive windows, since the caller normally does this
+// because the stream contents or position changed behind our back.
 void stream_drop_buffers(stream_t *s)
 {
-    s->pos = stream_tell(s);
+    drop_buffer(s);
+    for (int n = 0; n < s->num_windows; n++)
+        ta_free(s->windows[n].buffer);
+    s->num_windows = 0;
+    if (s->need_seek)
+        s->pos = s->backend_pos;
+    s->need_seek = false;
+}
+
+// Make the current buffer an inactive window (evicting the least recently used
+// one if needed), and leave the stream without buffer.
+static void stash_window(stream_t *s)
+{
+    if (!s->max_windows || s->buf_end == s->buf_start)
+        return;
+
+    // Don't keep buffers that were enlarged for a large peek.
+    if (s->buffer_mask + 1 > mp_round_next_power_of_2(s->requested_buffer_size))
+        return;
+
+    struct stream_window *w = NULL;
+    if (s->num_windows < s->max_windows) {
+        w = &s->windows[s->num_windows++];
+    } else {
+        w = &s->windows[0];
+        for (int n = 1; n < s->num_windows; n++) {
+            if (s->windows[n].last_use < w->last_use)
+                w = &s->windows[n];
+        }
+        ta_free(w->buffer);
+    }
+
+    *w = (struct stream_window){
+        .buffer = s->buffer,
+        .buffer_mask = s->buffer_mask,
+        .buf_start = s->buf_start,
+        .buf_end = s->buf_end,
+        .pos = s->pos,
+        .last_use = ++s->window_counter,
+    };
+
+    s->buffer = NULL;
+    s->buffer_mask = 0;
     s->buf_start = s->buf_cur = s->buf_end = 0;
-    s->eof = 0;
-    stream_resize_buffer(s, 0, 0);
+}
+
+// If pos is within an inactive window, exchange it with the current buffer, and
+// set the read position to pos. The actual stream is not seeked until the
+// buffer runs out.
+static bool seek_to_window(stream_t *s, int64_t pos)
+{
+    for (int n = 0; n < s->num_windows; n++) {
+        struct stream_window w = s->windows[n];
+        int64_t start = w.pos - (w.buf_end - w.buf_start);
+        if (pos < start || pos > w.pos)
+            continue;
+
+        MP_TRACE(s, "switch to buffer window %" PRId64 "-%" PRId64 "\n",
+                 start, w.pos);
+
+        if (s->buf_end != s->buf_start) {
+            s->windows[n] = (struct stream_window){
+                .buffer = s->buffer,
+                .buffer_mask = s->buffer_mask,
+                .buf_start = s->buf_start,
+                .buf_end = s->buf_end,
+                .pos = s->pos,
+                .last_use = ++s->window_counter,
+            };
+        } else {
+            ta_free(s->buffer);
+            MP_TARRAY_REMOVE_AT(s->windows, s->num_windows, n);
+        }
+
+        s->buffer = w.buffer;
+        s->buffer_mask = w.buffer_mask;
+        s->buf_start = w.buf_start;
+        s->buf_end = w.buf_end;
+        s->buf_cur = s->buf_start + (pos - start);
+        if (!s->need_seek)
+            s->backend_pos = s->pos;
+        s->pos = w.pos;
+        s->need_seek = true;
+        return true;
+    }
+    return false;
 }
 
 // Seek function bypassing the local stream buffer.
 static bool stream_seek_unbuffered(stream_t *s, int64_t newpos)
 {
-    if (newpos != s->pos) {
+    if (newpos != s->pos || s->need_seek) {
         MP_VERBOSE(s, "stream level seek from %" PRId64 " to %" PRId64 "\n",
                    s->pos, newpos);
 
@@ -700,13 +836,14 @@ static bool stream_seek_unbuffered(stream_t *s, int64_t newpos)
             MP_ERR(s, "Cannot seek backward in linear streams!\n");
             return false;
         }
-        if (s->seek(s, newpos) <= 0) {
+        if (!backend_seek(s, newpos)) {
             int level = mp_cancel_test(s->cancel) ? MSGL_V : MSGL_ERR;
             MP_MSG(s, level, "Seek failed (to %lld, size %lld)\n",
                    (long long)newpos, (long long)stream_get_size(s));
             return false;
         }
-        stream_drop_buffers(s);
+        stash_window(s);
+        drop_buffer(s);
         s->pos = newpos;
     }
     return true;
@@ -737,6 +874,9 @@ bool stream_seek(stream_t *s, int64_t pos)
     if (s->mode == STREAM_WRITE)
         return s->seekable && s->seek(s, pos);
 
+    if (seek_to_window(s, pos))
+        return true;
+
     // Skip data instead of performing a seek in some cases.
     if (pos >= s->pos &&
         ((!s->seekable && s->fast_skip) ||
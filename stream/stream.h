@@ -76,6 +76,10 @@ enum stream_ctrl {
     STREAM_CTRL_HAS_AVSEEK,
     STREAM_CTRL_GET_METADATA,
 
+    // Streams whose entire contents are in memory (bstr*, valid until the
+    // stream is closed; the data must not change while the stream is open)
+    STREAM_CTRL_GET_DIRECT_DATA,
+
     // Optical discs (internal interface between streams and demux_disc)
     STREAM_CTRL_GET_TIME_LENGTH,
     STREAM_CTRL_GET_DVD_INFO,
@@ -165,6 +169,7 @@ typedef struct stream {
     bool is_directory : 1; // directory on the filesystem
     bool access_references : 1; // open other streams
     bool allow_partial_read : 1; // allows partial read with stream_read_file()
+    bool need_seek : 1; // real position differs from pos (see stream_window)
     struct mp_log *log;
     struct mpv_global *global;
 
@@ -202,6 +207,12 @@ typedef struct stream {
 
     unsigned int buffer_mask; // buffer_size-1, where buffer_size == 2**n
     uint8_t *buffer;
+
+    // Inactive buffers of previously read positions (stream.c internal).
+    struct stream_window *windows;
+    int num_windows, max_windows;
+    uint64_t window_counter;
+    int64_t backend_pos; // real position while need_seek is set
 } stream_t;
 
 // Non-inline version of stream_read_char().
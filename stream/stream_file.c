@@ -91,6 +91,11 @@ struct priv {
     bool use_poll;
     bool regular_file;
     bool appending;
+    bool readahead;
+    int seq_reads;
+    int64_t pos;
+    int64_t readahead_size;
+    int64_t readahead_end;
     int64_t orig_size;
     struct mp_cancel *cancel;
 };
@@ -99,6 +104,17 @@ struct priv {
 #define RETRY_TIMEOUT 0.2
 #define MAX_RETRIES 10
 
+// Amount of data the kernel is asked to read ahead of the current position.
+// The next part is requested once half of it has been consumed, so the kernel
+// keeps reading while the demuxer processes the data already read. The window
+// starts at READAHEAD_MIN_SIZE, and doubles with each request.
+#define READAHEAD_MIN_SIZE (1024 * 1024)
+#define READAHEAD_SIZE (16 * 1024 * 1024)
+
+// Number of reads without seeking before readahead starts, so that random
+// access (probing, seeking around) doesn't make the kernel read unused data.
+#define READAHEAD_MIN_READS 8
+
 static int64_t get_size(stream_t *s)
 {
     struct priv *p = s->priv;
@@ -112,10 +128,33 @@ static int64_t get_size(stream_t *s)
     return -1;
 }
 
+static void update_readahead(struct priv *p)
+{
+#ifdef POSIX_FADV_WILLNEED
+    if (!p->readahead)
+        return;
+    if (p->seq_reads < READAHEAD_MIN_READS) {
+        p->seq_reads++;
+        return;
+    }
+    if (p->readahead_end - p->pos > p->readahead_size / 2)
+        return;
+
+    p->readahead_size = MPCLAMP(p->readahead_size * 2, READAHEAD_MIN_SIZE,
+                                READAHEAD_SIZE);
+    int64_t start = MPMAX(p->pos, p->readahead_end);
+    int64_t end = p->pos + p->readahead_size;
+    posix_fadvise(p->fd, start, end - start, POSIX_FADV_WILLNEED);
+    p->readahead_end = end;
+#endif
+}
+
 static int fill_buffer(stream_t *s, void *buffer, int max_len)
 {
     struct priv *p = s->priv;
 
+    update_readahead(p);
+
 #ifndef _WIN32
     if (p->use_poll) {
         int c = mp_cancel_get_fd(p->cancel);
@@ -131,8 +170,10 @@ static int fill_buffer(stream_t *s, void *buffer, int max_len)
 
     for (int retries = 0; retries < MAX_RETRIES; retries++) {
         int r = read(p->fd, buffer, max_len);
-        if (r > 0)
+        if (r > 0) {
+            p->pos += r;
             return r;
+        }
 
         // Try to detect and handle files being appended during playback.
         int64_t size = get_size(s);
@@ -161,7 +202,15 @@ static int write_buffer(stream_t *s, void *buffer, int len)
 static int seek(stream_t *s, int64_t newpos)
 {
     struct priv *p = s->priv;
-    return lseek(p->fd, newpos, SEEK_SET) != (off_t)-1;
+    if (lseek(p->fd, newpos, SEEK_SET) == (off_t)-1)
+        return 0;
+    if (newpos != p->pos) {
+        p->seq_reads = 0;
+        p->readahead_size = 0;
+        p->readahead_end = newpos;
+    }
+    p->pos = newpos;
+    return 1;
 }
 
 static void s_close(stream_t *s)
@@ -393,6 +442,9 @@ static int open_f(stream_t *stream, const struct stream_open_args *args)
 
     p->orig_size = get_size(stream);
 
+    // Network filesystems do their own readahead, if any.
+    p->readahead = p->regular_file && !write && !stream->streaming;
+
     p->cancel = mp_cancel_new(p);
     if (stream->cancel)
         mp_cancel_set_parent(p->cancel, stream->cancel);
@@ -44,12 +44,23 @@ static int64_t get_size(stream_t *s)
     return p->data.len;
 }
 
+static int control(stream_t *s, int cmd, void *arg)
+{
+    struct priv *p = s->priv;
+    if (cmd == STREAM_CTRL_GET_DIRECT_DATA) {
+        *(bstr *)arg = p->data;
+        return STREAM_OK;
+    }
+    return STREAM_UNSUPPORTED;
+}
+
 static int open2(stream_t *stream, const struct stream_open_args *args)
 {
     stream->fill_buffer = fill_buffer;
     stream->seek = seek;
     stream->seekable = true;
     stream->get_size = get_size;
+    stream->control = control;
 
     struct priv *p = talloc_zero(stream, struct priv);
     stream->priv = p;
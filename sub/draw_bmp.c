@@ -21,9 +21,14 @@
 #include <math.h>
 #include <inttypes.h>
 
+#include <libavutil/cpu.h>
+
 #include "common/common.h"
+#include "config.h"
 #include "draw_bmp.h"
 #include "img_convert.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "video/mp_image.h"
 #include "video/repack.h"
 #include "video/sws_utils.h"
@@ -58,6 +63,26 @@ struct slice {
     uint16_t x0, x1;
 };
 
+// Maximum number of threads used by blend_overlay_with_video(), the minimum
+// number of lines each of them blends, and the minimum number of OSD pixels
+// each of them blends.
+#define MAX_BLEND_THREADS 16
+#define MIN_BLEND_LINES 64
+#define MIN_BLEND_PIXELS (128 * 1024)
+
+// Per-thread state for blend_overlay_with_video(). The first one references the
+// repackers and buffers in mp_draw_sub_cache.
+struct blend_state {
+    struct mp_draw_sub_cache *p;
+    struct mp_repack *overlay_to_f32, *calpha_to_f32;
+    struct mp_repack *video_to_f32, *video_from_f32;
+    struct mp_image *overlay_tmp, *calpha_tmp, *video_tmp;
+    struct mp_image *dst;
+    int y0, y1;                     // range of lines to blend
+    bool ok;
+    struct mp_waiter thread_waiter;
+};
+
 struct mp_draw_sub_cache
 {
     struct mpv_global *global;
@@ -103,9 +128,40 @@ struct mp_draw_sub_cache
     // Function that works on the _f32 data.
     void (*blend_line)(void *dst, void *src, void *src_a, int w);
 
+    int rflags;                     // flags the repackers were created with
+    int overlay_fmt;                // source format of overlay_to_f32
+
+    struct blend_state *states;     // states[0] uses the fields above
+    int num_states;
+    struct mp_thread_pool *tp;      // for states[1..num_states-1]
+
     struct mp_image res_overlay;    // returned by mp_draw_sub_overlay()
 };
 
+#if HAVE_VECTOR
+
+typedef float v8sf __attribute__ ((vector_size (32), aligned (1)));
+
+static void blend_line_f32(void *dst, void *src, void *src_a, int w)
+{
+    float *dst_f = dst;
+    float *src_f = src;
+    float *src_a_f = src_a;
+
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        v8sf *vd = (v8sf *)&dst_f[x];
+        v8sf vs = *(v8sf *)&src_f[x];
+        v8sf va = *(v8sf *)&src_a_f[x];
+        *vd = vs + *vd * (1.0f - va);
+    }
+
+    for (; x < w; x++)
+        dst_f[x] = src_f[x] + dst_f[x] * (1.0f - src_a_f[x]);
+}
+
+#else // !HAVE_VECTOR
+
 static void blend_line_f32(void *dst, void *src, void *src_a, int w)
 {
     float *dst_f = dst;
@@ -116,21 +172,27 @@ static void blend_line_f32(void *dst, void *src, void *src_a, int w)
         dst_f[x] = src_f[x] + dst_f[x] * (1.0f - src_a_f[x]);
 }
 
+#endif // HAVE_VECTOR
+
 static void blend_line_u8(void *dst, void *src, void *src_a, int w)
 {
     uint8_t *dst_i = dst;
     uint8_t *src_i = src;
     uint8_t *src_a_i = src_a;
 
-    for (int x = 0; x < w; x++)
-        dst_i[x] = src_i[x] + dst_i[x] * (255u - src_a_i[x]) / 255u;
+    // v / 255, exact for v <= 255 * 255, and without division, so that the
+    // compiler can vectorize it.
+    for (int x = 0; x < w; x++) {
+        uint16_t v = dst_i[x] * (255u - src_a_i[x]);
+        dst_i[x] = src_i[x] + ((v + 1u + (v >> 8)) >> 8);
+    }
 }
 
-static void blend_slice(struct mp_draw_sub_cache *p)
+static void blend_slice(struct mp_draw_sub_cache *p, struct blend_state *st)
 {
-    struct mp_image *ov = p->overlay_tmp;
-    struct mp_image *ca = p->calpha_tmp;
-    struct mp_image *vid = p->video_tmp;
+    struct mp_image *ov = st->overlay_tmp;
+    struct mp_image *ca = st->calpha_tmp;
+    struct mp_image *vid = st->video_tmp;
 
     for (int plane = 0; plane < vid->num_planes; plane++) {
         int xs = vid->fmt.xs[plane];
@@ -147,18 +209,22 @@ static void blend_slice(struct mp_draw_sub_cache *p)
     }
 }
 
-static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
-                                     struct mp_image *dst)
+static void blend_lines(struct blend_state *st)
 {
-    if (!repack_config_buffers(p->video_to_f32, 0, p->video_tmp, 0, dst, NULL))
-        return false;
-    if (!repack_config_buffers(p->video_from_f32, 0, dst, 0, p->video_tmp, NULL))
-        return false;
+    struct mp_draw_sub_cache *p = st->p;
+    struct mp_image *dst = st->dst;
+
+    st->ok = repack_config_buffers(st->video_to_f32, 0, st->video_tmp,
+                                   0, dst, NULL) &&
+             repack_config_buffers(st->video_from_f32, 0, dst,
+                                   0, st->video_tmp, NULL);
+    if (!st->ok)
+        return;
 
     int xs = dst->fmt.chroma_xs;
     int ys = dst->fmt.chroma_ys;
 
-    for (int y = 0; y < dst->h; y += p->align_y) {
+    for (int y = st->y0; y < st->y1; y += p->align_y) {
         struct slice *line = &p->slices[y * p->s_w];
 
         for (int sx = 0; sx < p->s_w; sx++) {
@@ -173,18 +239,83 @@ static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
             assert(MP_IS_ALIGNED(w, p->align_x));
             assert(x + w <= p->w);
 
-            repack_line(p->overlay_to_f32, 0, 0, x, y, w);
-            repack_line(p->video_to_f32, 0, 0, x, y, w);
-            if (p->calpha_to_f32)
-                repack_line(p->calpha_to_f32, 0, 0, x >> xs, y >> ys, w >> xs);
+            repack_line(st->overlay_to_f32, 0, 0, x, y, w);
+            repack_line(st->video_to_f32, 0, 0, x, y, w);
+            if (st->calpha_to_f32)
+                repack_line(st->calpha_to_f32, 0, 0, x >> xs, y >> ys, w >> xs);
 
-            blend_slice(p);
+            blend_slice(p, st);
 
-            repack_line(p->video_from_f32, x, y, 0, 0, w);
+            repack_line(st->video_from_f32, x, y, 0, 0, w);
         }
     }
+}
 
-    return true;
+static void blend_lines_thread(void *ptr)
+{
+    struct blend_state *st = ptr;
+
+    blend_lines(st);
+    mp_waiter_wakeup(&st->thread_waiter, 0);
+}
+
+static bool blend_overlay_with_video(struct mp_draw_sub_cache *p,
+                                     struct mp_image *dst)
+{
+    // Find the lines that contain OSD, and how many pixels need blending.
+    int y0 = dst->h, y1 = 0;
+    uint64_t pixels = 0;
+    for (int y = 0; y < dst->h; y += p->align_y) {
+        struct slice *line = &p->slices[y * p->s_w];
+        uint64_t line_pixels = 0;
+        for (int sx = 0; sx < p->s_w; sx++)
+            line_pixels += MPMAX(line[sx].x1 - line[sx].x0, 0);
+        if (line_pixels) {
+            y0 = MPMIN(y0, y);
+            y1 = y + p->align_y;
+            pixels += line_pixels * p->align_y;
+        }
+    }
+    y1 = MPMIN(y1, dst->h);
+    if (y0 >= y1)
+        return true;
+
+    // Small OSD (like a line of subtitles) is faster to blend on one thread.
+    int num_states = MPCLAMP(pixels / MIN_BLEND_PIXELS, 1, p->num_states);
+
+    // Split the OSD lines into horizontal stripes, one for each thread. Lines
+    // are aligned to chroma, so the threads never touch the same pixels.
+    int lines = (y1 - y0 + num_states - 1) / num_states;
+    lines = MP_ALIGN_UP(lines, p->align_y);
+
+    for (int n = 0; n < num_states; n++) {
+        struct blend_state *st = &p->states[n];
+        st->dst = dst;
+        st->y0 = MPMIN(y0 + n * lines, y1);
+        st->y1 = MPMIN(st->y0 + lines, y1);
+    }
+
+    for (int n = 1; n < num_states; n++) {
+        struct blend_state *st = &p->states[n];
+
+        st->thread_waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+
+        // Threads are created on demand, which can fail.
+        if (!mp_thread_pool_run(p->tp, blend_lines_thread, st))
+            blend_lines_thread(st);
+    }
+
+    blend_lines(&p->states[0]);
+
+    bool ok = p->states[0].ok;
+    for (int n = 1; n < num_states; n++) {
+        struct blend_state *st = &p->states[n];
+
+        mp_waiter_wait(&st->thread_waiter);
+        ok &= st->ok;
+    }
+
+    return ok;
 }
 
 static bool convert_overlay_part(struct mp_draw_sub_cache *p,
@@ -520,6 +651,90 @@ static void init_general(struct mp_draw_sub_cache *p)
     clear_rgba_overlay(p);
 }
 
+// Create repackers and buffers for an additional blending thread.
+static bool init_blend_state(struct mp_draw_sub_cache *p, struct blend_state *st)
+{
+    *st = (struct blend_state){.p = p};
+
+    st->video_to_f32 = mp_repack_create_planar(p->params.imgfmt, false, p->rflags);
+    talloc_steal(p, st->video_to_f32);
+    st->video_from_f32 = mp_repack_create_planar(p->params.imgfmt, true, p->rflags);
+    talloc_steal(p, st->video_from_f32);
+    st->overlay_to_f32 = mp_repack_create_planar(p->overlay_fmt, false, p->rflags);
+    talloc_steal(p, st->overlay_to_f32);
+    if (!st->video_to_f32 || !st->video_from_f32 || !st->overlay_to_f32)
+        return false;
+
+    st->overlay_tmp = talloc_steal(p,
+        mp_image_alloc(p->overlay_tmp->imgfmt, SLICE_W, p->overlay_tmp->h));
+    st->video_tmp = talloc_steal(p,
+        mp_image_alloc(p->video_tmp->imgfmt, SLICE_W, p->video_tmp->h));
+    if (!st->overlay_tmp || !st->video_tmp)
+        return false;
+
+    st->overlay_tmp->params.repr = p->overlay_tmp->params.repr;
+    st->overlay_tmp->params.color = p->overlay_tmp->params.color;
+    st->video_tmp->params.repr = p->video_tmp->params.repr;
+    st->video_tmp->params.color = p->video_tmp->params.color;
+
+    struct mp_image *ov = p->video_overlay ? p->video_overlay : p->rgba_overlay;
+    if (!repack_config_buffers(st->overlay_to_f32, 0, st->overlay_tmp,
+                               0, ov, NULL))
+        return false;
+
+    if (p->calpha_to_f32) {
+        st->calpha_to_f32 = mp_repack_create_planar(p->calpha_overlay->imgfmt,
+                                                    false, p->rflags);
+        talloc_steal(p, st->calpha_to_f32);
+        if (!st->calpha_to_f32)
+            return false;
+
+        st->calpha_tmp = talloc_steal(p,
+            mp_image_alloc(p->calpha_tmp->imgfmt, SLICE_W, 1));
+        if (!st->calpha_tmp)
+            return false;
+
+        if (!repack_config_buffers(st->calpha_to_f32, 0, st->calpha_tmp,
+                                   0, p->calpha_overlay, NULL))
+            return false;
+    }
+
+    return true;
+}
+
+// Set up blending with as many threads as useful. The threads are created when
+// blending needs them, and exit again when they're idle for a while.
+static void init_blend_threads(struct mp_draw_sub_cache *p)
+{
+    int threads = MPMIN(av_cpu_count(), MAX_BLEND_THREADS);
+    threads = MPMIN(threads, p->h / MIN_BLEND_LINES);
+    threads = MPMAX(threads, 1);
+
+    p->states = talloc_zero_array(p, struct blend_state, threads);
+    p->states[0] = (struct blend_state){
+        .p = p,
+        .overlay_to_f32 = p->overlay_to_f32,
+        .calpha_to_f32 = p->calpha_to_f32,
+        .video_to_f32 = p->video_to_f32,
+        .video_from_f32 = p->video_from_f32,
+        .overlay_tmp = p->overlay_tmp,
+        .calpha_tmp = p->calpha_tmp,
+        .video_tmp = p->video_tmp,
+    };
+    p->num_states = 1;
+
+    if (threads < 2)
+        return;
+
+    p->tp = mp_thread_pool_create(p, 0, 0, threads - 1);
+
+    while (p->num_states < threads) {
+        if (!init_blend_state(p, &p->states[p->num_states]))
+            break;
+        p->num_states++;
+    }
+}
+
 static bool reinit_to_video(struct mp_draw_sub_cache *p)
 {
     struct mp_image_params *params = &p->params;
@@ -614,6 +829,9 @@ static bool reinit_to_video(struct mp_draw_sub_cache *p)
     if (!p->overlay_to_f32)
         return false;
 
+    p->rflags = rflags;
+    p->overlay_fmt = overlay_fmt;
+
     int render_fmt = mp_repack_get_format_dst(p->overlay_to_f32);
 
     struct mp_regular_imgfmt ofdesc = {0};
@@ -774,6 +992,7 @@ static bool reinit_to_video(struct mp_draw_sub_cache *p)
     }
 
     init_general(p);
+    init_blend_threads(p);
 
     return true;
 }
@@ -0,0 +1,101 @@
+#include <stdio.h>
+
+#include "demux/cache.h"
+#include "test_utils.h"
+
+#define DATA_SIZE 1000
+
+// Header field offsets, see struct index_header in demux/cache_index.c.
+#define OFFSET_SIG_LEN 12
+#define OFFSET_NUM_QUEUES 24
+#define OFFSET_NUM_PKTS 32
+
+// Write data to a temporary file, and try to parse it as index.
+static struct demux_cache_index *read_index(void *ta_ctx, bstr data)
+{
+    FILE *f = tmpfile();
+    assert_true(f);
+    assert_int_equal(fwrite(data.start, 1, data.len, f), data.len);
+    fflush(f);
+    rewind(f);
+    struct demux_cache_index *index =
+        demux_cache_index_read(ta_ctx, fileno(f), DATA_SIZE);
+    fclose(f);
+    return index;
+}
+
+static bstr patch(void *ta_ctx, bstr data, size_t offset, void *val, size_t size)
+{
+    bstr res = bstrdup(ta_ctx, data);
+    memcpy(res.start + offset, val, size);
+    return res;
+}
+
+int main(void)
+{
+    void *ta_ctx = talloc_new(NULL);
+
+    struct demux_cache_index_queue queues[] = {
+        {.range = 0, .stream = 0, .num_pkts = 2, .seek_end = 1.0},
+        {.range = 0, .stream = 1, .num_pkts = 1, .seek_end = 1.0},
+    };
+    struct demux_cache_index_pkt pkts[] = {
+        {.cache_pos = 0, .pts = 0.0, .keyframe = 1},
+        {.cache_pos = 100, .pts = 0.5},
+        {.cache_pos = 200, .pts = 0.0, .keyframe = 1},
+    };
+    struct demux_cache_index src = {
+        .streams_sig = "video:h264:0;audio:aac:1;",
+        .queues = queues,
+        .num_queues = MP_ARRAY_SIZE(queues),
+        .pkts = pkts,
+        .num_pkts = MP_ARRAY_SIZE(pkts),
+    };
+    bstr data = demux_cache_index_serialize(ta_ctx, &src, DATA_SIZE);
+
+    // Valid index round-trips.
+    struct demux_cache_index *index = read_index(ta_ctx, data);
+    assert_true(index);
+    assert_string_equal(index->streams_sig, src.streams_sig);
+    assert_int_equal(index->num_queues, src.num_queues);
+    assert_int_equal(index->num_pkts, src.num_pkts);
+    assert_memcmp(index->queues, queues, sizeof(queues));
+    assert_memcmp(index->pkts, pkts, sizeof(pkts));
+
+    // Truncated files.
+    for (size_t len = 0; len < data.len; len++)
+        assert_false(read_index(ta_ctx, (bstr){data.start, len}));
+
+    // Trailing garbage.
+    bstr longer = bstrdup(ta_ctx, data);
+    bstr_xappend(ta_ctx, &longer, bstr0("x"));
+    assert_false(read_index(ta_ctx, longer));
+
+    // Sizes that would overflow or cause huge allocations.
+    uint32_t sig_len = UINT32_MAX;
+    assert_false(read_index(ta_ctx,
+        patch(ta_ctx, data, OFFSET_SIG_LEN, &sig_len, sizeof(sig_len))));
+    uint64_t huge = UINT64_MAX / 2;
+    assert_false(read_index(ta_ctx,
+        patch(ta_ctx, data, OFFSET_NUM_QUEUES, &huge, sizeof(huge))));
+    assert_false(read_index(ta_ctx,
+        patch(ta_ctx, data, OFFSET_NUM_PKTS, &huge, sizeof(huge))));
+
+    // Counts that are consistent with the file size, but not with each other.
+    queues[0].num_pkts = UINT64_MAX;
+    assert_false(read_index(ta_ctx,
+                            demux_cache_index_serialize(ta_ctx, &src, DATA_SIZE)));
+    queues[0].num_pkts = 2;
+
+    // Packets outside of the cache file.
+    pkts[2].cache_pos = DATA_SIZE;
+    assert_false(read_index(ta_ctx,
+                            demux_cache_index_serialize(ta_ctx, &src, DATA_SIZE)));
+    pkts[2].cache_pos = 200;
+
+    // Bad magic.
+    assert_false(read_index(ta_ctx, patch(ta_ctx, data, 0, "x", 1)));
+
+    talloc_free(ta_ctx);
+    return 0;
+}
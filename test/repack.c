@@ -4,6 +4,7 @@
 
 #include "common/common.h"
 #include "img_utils.h"
+#include "osdep/timer.h"
 #include "sub/draw_bmp.h"
 #include "sub/osd.h"
 #include "test_utils.h"
@@ -483,10 +484,74 @@ done:
     return ok;
 }
 
+// Measure throughput of the conversion between imgfmt and its planar (or
+// planar float) variant, for the conversions used on the hot paths.
+static void benchmark_repack(int imgfmt, bool pack, int flags)
+{
+    imgfmt = UNFUCK(imgfmt);
+
+    int w = 1920, h = 1080, runs = 50;
+
+    struct mp_repack *rp = mp_repack_create_planar(imgfmt, pack, flags);
+    assert(rp);
+
+    int fmt_src = mp_repack_get_format_src(rp);
+    int fmt_dst = mp_repack_get_format_dst(rp);
+    struct mp_image *src = mp_image_alloc(fmt_src, w, h);
+    struct mp_image *dst = mp_image_alloc(fmt_dst, w, h);
+    assert(src && dst);
+
+    for (int p = 0; p < src->num_planes; p++) {
+        memset(src->planes[p], 0,
+               (size_t)src->stride[p] * mp_image_plane_h(src, p));
+    }
+
+    repack_config_buffers(rp, 0, dst, 0, src, NULL);
+
+    int align_y = mp_repack_get_align_y(rp);
+    int64_t start = mp_time_ns();
+    for (int n = 0; n < runs; n++) {
+        for (int y = 0; y < h; y += align_y)
+            repack_line(rp, 0, y, 0, y, w);
+    }
+    double secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+
+    printf("%-12s -> %-12s %8.1f Mpixels/s\n", mp_imgfmt_to_name(fmt_src),
+           mp_imgfmt_to_name(fmt_dst), w * (double)h * runs / secs / 1e6);
+
+    talloc_free(src);
+    talloc_free(dst);
+    talloc_free(rp);
+}
+
+static void run_benchmarks(void)
+{
+    mp_time_init();
+
+    static const int fmts[] = {IMGFMT_NV12, IMGFMT_P010, IMGFMT_RGB0};
+    for (int n = 0; n < MP_ARRAY_SIZE(fmts); n++) {
+        benchmark_repack(fmts[n], false, 0);
+        benchmark_repack(fmts[n], true, 0);
+    }
+
+    // draw_bmp
+    static const int f32_fmts[] = {IMGFMT_420P, IMGFMT_NV12, IMGFMT_P010};
+    for (int n = 0; n < MP_ARRAY_SIZE(f32_fmts); n++) {
+        benchmark_repack(f32_fmts[n], false, REPACK_CREATE_PLANAR_F32);
+        benchmark_repack(f32_fmts[n], true, REPACK_CREATE_PLANAR_F32);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     const char *refdir = argv[1];
     const char *outdir = argv[2];
+
+    if (argc > 3 && !strcmp(argv[3], "benchmark")) {
+        run_benchmarks();
+        return 0;
+    }
+
     FILE *f = test_open_out(outdir, "repack.txt");
 
     init_imgfmts_list();
@@ -0,0 +1,166 @@
+#include "audio/filter/af_scaletempo2_internals.h"
+#include "misc/random.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+#define RATE 48000
+#define CHANNELS 2
+#define INPUT_FRAMES (RATE * 2)
+#define SPEED 1.5
+
+#define NUM_BLOCKS 50
+
+struct result {
+    float *out[CHANNELS];
+    int frames;
+    double secs;
+};
+
+// Band-limited noise, so that the similarity measure has distinct maxima.
+static void gen_noise(float *buf, int frames)
+{
+    float state = 0;
+    for (int n = 0; n < frames; n++) {
+        state = state * 0.9f + (mp_rand_next_double() * 2 - 1) * 0.1f;
+        buf[n] = state;
+    }
+}
+
+static void gen_input(float *in[CHANNELS])
+{
+    mp_rand_seed(1);
+    for (int c = 0; c < CHANNELS; c++)
+        gen_noise(in[c], INPUT_FRAMES);
+}
+
+static struct mp_scaletempo2 *create(struct mp_scaletempo2_opts *opts,
+                                     int search_mode, int search_interval_ms)
+{
+    *opts = (struct mp_scaletempo2_opts) {
+        .min_playback_rate = 0.25,
+        .max_playback_rate = 8.0,
+        .ola_window_size_ms = 12,
+        .wsola_search_interval_ms = search_interval_ms,
+        .search_mode = search_mode,
+    };
+    struct mp_scaletempo2 *p = talloc_zero(NULL, struct mp_scaletempo2);
+    p->opts = opts;
+    mp_scaletempo2_init(p, CHANNELS, RATE);
+    return p;
+}
+
+static void run(void *ta_ctx, float *in[CHANNELS], int search_mode,
+                int search_interval_ms, struct result *res)
+{
+    struct mp_scaletempo2_opts opts;
+    struct mp_scaletempo2 *p = create(&opts, search_mode, search_interval_ms);
+
+    int out_size = INPUT_FRAMES;
+    for (int c = 0; c < CHANNELS; c++)
+        res->out[c] = talloc_zero_array(ta_ctx, float, out_size);
+    res->frames = 0;
+
+    int64_t start = mp_time_ns();
+    int pos = 0;
+    bool final = false;
+    while (res->frames < out_size) {
+        if (pos < INPUT_FRAMES) {
+            uint8_t *planes[CHANNELS];
+            for (int c = 0; c < CHANNELS; c++)
+                planes[c] = (uint8_t *)(in[c] + pos);
+            pos += mp_scaletempo2_fill_input_buffer(p, planes,
+                INPUT_FRAMES - pos, SPEED);
+        } else if (!final) {
+            mp_scaletempo2_set_final(p);
+            final = true;
+        }
+        if (!mp_scaletempo2_frames_available(p, SPEED))
+            break;
+        float *dest[CHANNELS];
+        for (int c = 0; c < CHANNELS; c++)
+            dest[c] = res->out[c] + res->frames;
+        int frames = MPMIN(p->ola_hop_size, out_size - res->frames);
+        res->frames += mp_scaletempo2_fill_buffer(p, dest, frames, SPEED);
+    }
+    res->secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+
+    talloc_free(p);
+}
+
+// Search noise for a copy of the target block, which is clearly more similar
+// than any other candidate. The FFT based search must find exactly the same
+// block as the direct search, regardless of how the FFT rounds.
+static void search_blocks(int search_interval_ms)
+{
+    struct mp_scaletempo2_opts direct_opts, fft_opts;
+    struct mp_scaletempo2 *direct =
+        create(&direct_opts, SCALETEMPO2_SEARCH_DIRECT, search_interval_ms);
+    struct mp_scaletempo2 *fft =
+        create(&fft_opts, SCALETEMPO2_SEARCH_FFT, search_interval_ms);
+    assert_false(direct->xcorr);
+    assert_true(fft->xcorr);
+
+    int num_candidates = direct->num_candidate_blocks;
+    mp_rand_seed(search_interval_ms);
+    for (int n = 0; n < NUM_BLOCKS; n++) {
+        int expected = mp_rand_next() % num_candidates;
+        // Exclude the blocks around the opposite end of the search block.
+        int last_optimal = expected < num_candidates / 2 ? num_candidates - 1 : 0;
+        for (int c = 0; c < CHANNELS; c++) {
+            gen_noise(direct->search_block[c], direct->search_block_size);
+            memcpy(direct->target_block[c], direct->search_block[c] + expected,
+                   direct->ola_window_size * sizeof(float));
+            memcpy(fft->search_block[c], direct->search_block[c],
+                   direct->search_block_size * sizeof(float));
+            memcpy(fft->target_block[c], direct->target_block[c],
+                   direct->ola_window_size * sizeof(float));
+        }
+        assert_int_equal(mp_scaletempo2_find_optimal_index(direct, last_optimal),
+                         expected);
+        assert_int_equal(mp_scaletempo2_find_optimal_index(fft, last_optimal),
+                         expected);
+    }
+
+    talloc_free(direct);
+    talloc_free(fft);
+}
+
+// The FFT based search may choose different blocks when they are about equally
+// similar, so only the amount of output is compared.
+static void compare(void *ta_ctx, float *in[CHANNELS], int search_interval_ms,
+                    bool benchmark)
+{
+    struct result direct, fft;
+    run(ta_ctx, in, SCALETEMPO2_SEARCH_DIRECT, search_interval_ms, &direct);
+    run(ta_ctx, in, SCALETEMPO2_SEARCH_FFT, search_interval_ms, &fft);
+
+    assert_true(direct.frames > INPUT_FRAMES / SPEED / 2);
+    assert_int_equal(direct.frames, fft.frames);
+
+    if (benchmark) {
+        printf("search-interval=%d: direct %.3f ms, fft %.3f ms\n",
+               search_interval_ms, direct.secs * 1e3, fft.secs * 1e3);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool benchmark = argc > 1 && !strcmp(argv[1], "benchmark");
+    void *ta_ctx = talloc_new(NULL);
+
+    mp_time_init();
+
+    float *in[CHANNELS];
+    for (int c = 0; c < CHANNELS; c++)
+        in[c] = talloc_array(ta_ctx, float, INPUT_FRAMES);
+    gen_input(in);
+
+    static const int intervals[] = {10, 40, 100};
+    for (int n = 0; n < MP_ARRAY_SIZE(intervals); n++) {
+        search_blocks(intervals[n]);
+        compare(ta_ctx, in, intervals[n], benchmark);
+    }
+
+    talloc_free(ta_ctx);
+    return 0;
+}
@@ -217,9 +217,11 @@ typedef struct lavc_ctx {
 
     // --- The following fields are protected by dr_lock.
     mp_mutex dr_lock;
+    bool dr_enabled;    // set on init only, false if only hugepage_pool is used
     bool dr_failed;
     struct mp_image_pool *dr_pool;
     int dr_imgfmt, dr_w, dr_h, dr_stride_align;
+    struct mp_image_pool *hugepage_pool; // for --image-pool-hugepages
 
     struct mp_decoder public;
 } vd_ffmpeg_ctx;
@@ -758,7 +760,9 @@ static void init_avctx(struct mp_filter *vd)
         mp_set_avcodec_threads(vd->log, avctx, lavc_param->threads);
     }
 
-    if (!ctx->use_hwdec && ctx->vo && lavc_param->dr) {
+    // Also used to allocate software decoded frames from huge pages.
+    ctx->dr_enabled = ctx->vo && lavc_param->dr;
+    if (!ctx->use_hwdec) {
         avctx->opaque = vd;
         avctx->get_buffer2 = get_buffer2_direct;
     }
@@ -1020,6 +1024,9 @@ static int get_buffer2_direct(AVCodecContext *avctx, AVFrame *pic, int flags)
     }
 
     int imgfmt = pixfmt2imgfmt(pic->format);
+    if (!p->dr_enabled)
+        goto no_dr;
+
     if (!imgfmt)
         goto fallback;
 
@@ -1079,6 +1086,26 @@ fallback:
     if (!p->dr_failed)
         MP_VERBOSE(p, "DR failed - disabling.\n");
     p->dr_failed = true;
+
+no_dr:
+    // The pool allocates from huge pages only with MP_IMAGE_BYTE_ALIGN.
+    if (imgfmt && mp_image_pool_get_hugepages() &&
+        (avctx->codec->capabilities & AV_CODEC_CAP_DR1) &&
+        MP_IMAGE_BYTE_ALIGN % stride_align == 0)
+    {
+        img = mp_image_pool_get(p->hugepage_pool, imgfmt, w, h);
+        if (img) {
+            for (int n = 0; n < 4; n++) {
+                pic->data[n] = img->planes[n];
+                pic->linesize[n] = img->stride[n];
+                pic->buf[n] = img->bufs[n];
+                img->bufs[n] = NULL;
+            }
+            talloc_free(img);
+            mp_mutex_unlock(&p->dr_lock);
+            return 0;
+        }
+    }
     mp_mutex_unlock(&p->dr_lock);
 
     return avcodec_default_get_buffer2(avctx, pic, flags);
@@ -1410,6 +1437,7 @@ static struct mp_decoder *create(struct mp_filter *parent,
     ctx->decoder = talloc_strdup(ctx, decoder);
     ctx->hwdec_swpool = mp_image_pool_new(ctx);
     ctx->dr_pool = mp_image_pool_new(ctx);
+    ctx->hugepage_pool = mp_image_pool_new(ctx);
 
     ctx->public.f = vd;
     ctx->public.control = control;
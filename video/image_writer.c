@@ -99,9 +99,31 @@ const struct m_option image_writer_opts[] = {
     {"avif-pixfmt", OPT_STRING(avif_pixfmt)},
     {"high-bit-depth", OPT_BOOL(high_bit_depth)},
     {"tag-colorspace", OPT_BOOL(tag_csp)},
+    {"threads", OPT_CHOICE(threads, {"auto", 0}), M_RANGE(1, 64)},
     {0},
 };
 
+static void free_opts(void *p)
+{
+    struct image_writer_opts *opts = p;
+
+    for (const struct m_option *opt = image_writer_opts; opt->name; opt++)
+        m_option_free(opt, (char *)opts + opt->offset);
+}
+
+struct image_writer_opts *image_writer_opts_dup(void *ta_parent,
+                                                const struct image_writer_opts *opts)
+{
+    struct image_writer_opts *res = talloc_zero(ta_parent, struct image_writer_opts);
+
+    for (const struct m_option *opt = image_writer_opts; opt->name; opt++) {
+        m_option_copy(opt, (char *)res + opt->offset,
+                      (const char *)opts + opt->offset);
+    }
+    talloc_set_destructor(res, free_opts);
+    return res;
+}
+
 struct image_writer_ctx {
     struct mp_log *log;
     const struct image_writer_opts *opts;
@@ -178,6 +200,7 @@ static bool write_lavc(struct image_writer_ctx *ctx, mp_image_t *image, FILE *fp
     avctx->time_base = AV_TIME_BASE_Q;
     avctx->width = image->w;
     avctx->height = image->h;
+    avctx->thread_count = ctx->opts->threads;
     avctx->pix_fmt = imgfmt2pixfmt(image->imgfmt);
     if (codec->id == AV_CODEC_ID_MJPEG) {
         // Annoying deprecated garbage for the jpg encoder.
@@ -362,6 +385,7 @@ static bool write_avif(struct image_writer_ctx *ctx, mp_image_t *image, FILE *fp
 
     avctx->width = image->w;
     avctx->height = image->h;
+    avctx->thread_count = ctx->opts->threads;
     avctx->time_base = (AVRational){1, 30};
     avctx->pkt_timebase = (AVRational){1, 30};
     avctx->codec_type = AVMEDIA_TYPE_VIDEO;
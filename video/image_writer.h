@@ -36,12 +36,17 @@ struct image_writer_opts {
     char *avif_pixfmt;
     char **avif_opts;
     bool tag_csp;
+    int threads;
 };
 
 extern const struct image_writer_opts image_writer_opts_defaults;
 
 extern const struct m_option image_writer_opts[];
 
+// Return a deep copy of opts, which stays valid if the options change.
+struct image_writer_opts *image_writer_opts_dup(void *ta_parent,
+                                                const struct image_writer_opts *opts);
+
 // Return the file extension that will be used, e.g. "png".
 const char *image_writer_file_ext(const struct image_writer_opts *opts);
 
@@ -17,10 +17,16 @@
 
 #include "config.h"
 
+#include <limits.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include <assert.h>
 
+#if HAVE_POSIX
+#include <sys/mman.h>
+#endif
+
 #include <libavutil/buffer.h>
 #include <libavutil/hwcontext.h>
 #if HAVE_VULKAN
@@ -32,6 +38,7 @@
 #include "mpv_talloc.h"
 
 #include "common/common.h"
+#include "common/stats.h"
 
 #include "fmt-conversion.h"
 #include "mp_image_pool.h"
@@ -45,10 +52,13 @@ static mp_static_mutex pool_mutex = MP_STATIC_MUTEX_INITIALIZER;
 // Thread-safety: the pool itself is not thread-safe, but pool-allocated images
 // can be referenced and unreferenced from other threads. (As long as the image
 // destructors are thread-safe.)
+// The images[] array is accessed with pool_mutex held, because idle images can
+// be reclaimed by other threads (see reclaim_images()).
 
 struct mp_image_pool {
     struct mp_image **images;
     int num_images;
+    size_t bytes;               // sum of image_flags.size of images[]
 
     int fmt, w, h;
 
@@ -66,12 +76,37 @@ struct image_flags {
     bool referenced;            // outside mp_image reference exists
     bool pool_alive;            // the mp_image_pool references this
     unsigned int order;         // for LRU allocation (basically a timestamp)
+    uint64_t last_used;         // for reclaiming across pools (global order)
+    size_t size;                // size of the image data
+    bool reclaimable;           // can be freed by reclaim_images()
 };
 
+// Process-wide state of all pools, protected by pool_mutex.
+static struct mp_image_pool **all_pools;
+static int num_all_pools;
+static size_t total_bytes;      // sum of mp_image_pool.bytes
+static size_t max_bytes;        // 0 means unlimited
+static uint64_t use_counter;
+static int reported_fmts[32];   // for mp_image_pool_report_stats()
+static int num_reported_fmts;
+
+static atomic_bool use_hugepages;
+
 static void image_pool_destructor(void *ptr)
 {
     struct mp_image_pool *pool = ptr;
     mp_image_pool_clear(pool);
+
+    pool_lock();
+    for (int n = 0; n < num_all_pools; n++) {
+        if (all_pools[n] == pool) {
+            MP_TARRAY_REMOVE_AT(all_pools, num_all_pools, n);
+            break;
+        }
+    }
+    if (!num_all_pools)
+        TA_FREEP(&all_pools);
+    pool_unlock();
 }
 
 // If tparent!=NULL, set it as talloc parent for the pool.
@@ -80,24 +115,230 @@ struct mp_image_pool *mp_image_pool_new(void *tparent)
     struct mp_image_pool *pool = talloc_ptrtype(tparent, pool);
     talloc_set_destructor(pool, image_pool_destructor);
     *pool = (struct mp_image_pool) {0};
+
+    pool_lock();
+    MP_TARRAY_APPEND(NULL, all_pools, num_all_pools, pool);
+    pool_unlock();
+
     return pool;
 }
 
+// Remove the image from the pool. Returns whether it is unreferenced, i.e.
+// whether the caller has to free it. Call with pool_mutex held.
+static bool remove_image(struct mp_image_pool *pool, int index)
+{
+    struct mp_image *img = pool->images[index];
+    struct image_flags *it = img->priv;
+    assert(it->pool_alive);
+    it->pool_alive = false;
+    pool->bytes -= it->size;
+    total_bytes -= it->size;
+    MP_TARRAY_REMOVE_AT(pool->images, pool->num_images, index);
+    return !it->referenced;
+}
+
 void mp_image_pool_clear(struct mp_image_pool *pool)
 {
-    for (int n = 0; n < pool->num_images; n++) {
-        struct mp_image *img = pool->images[n];
-        struct image_flags *it = img->priv;
-        bool referenced;
-        pool_lock();
-        assert(it->pool_alive);
-        it->pool_alive = false;
-        referenced = it->referenced;
-        pool_unlock();
-        if (!referenced)
-            talloc_free(img);
+    struct mp_image **unused = NULL;
+    int num_unused = 0;
+
+    pool_lock();
+    while (pool->num_images) {
+        struct mp_image *img = pool->images[pool->num_images - 1];
+        if (remove_image(pool, pool->num_images - 1))
+            MP_TARRAY_APPEND(NULL, unused, num_unused, img);
+    }
+    pool_unlock();
+
+    for (int n = 0; n < num_unused; n++)
+        talloc_free(unused[n]);
+    talloc_free(unused);
+}
+
+// Free unreferenced images of all pools, least recently used first, until the
+// total size is within the limit set with mp_image_pool_set_max_bytes().
+// Only images allocated with mp_image_alloc() or mp_image_hugepage_alloc() are
+// freed; custom allocators might require freeing on a specific thread.
+static void reclaim_images(void)
+{
+    struct mp_image **unused = NULL;
+    int num_unused = 0;
+
+    pool_lock();
+    while (max_bytes && total_bytes > max_bytes) {
+        struct mp_image_pool *victim = NULL;
+        int victim_index = -1;
+        uint64_t oldest = UINT64_MAX;
+        for (int p = 0; p < num_all_pools; p++) {
+            struct mp_image_pool *pool = all_pools[p];
+            for (int n = 0; n < pool->num_images; n++) {
+                struct image_flags *it = pool->images[n]->priv;
+                if (it->reclaimable && !it->referenced &&
+                    it->last_used < oldest)
+                {
+                    victim = pool;
+                    victim_index = n;
+                    oldest = it->last_used;
+                }
+            }
+        }
+        if (!victim)
+            break;
+        struct mp_image *img = victim->images[victim_index];
+        remove_image(victim, victim_index);
+        MP_TARRAY_APPEND(NULL, unused, num_unused, img);
+    }
+    pool_unlock();
+
+    for (int n = 0; n < num_unused; n++)
+        talloc_free(unused[n]);
+    talloc_free(unused);
+}
+
+// Limit the size of all images held by all pools to the given number of bytes
+// (0 disables the limit). If the limit is exceeded, unused images are freed,
+// but images in use are never touched. This is a process-wide setting.
+// This function is thread-safe.
+void mp_image_pool_set_max_bytes(size_t bytes)
+{
+    pool_lock();
+    max_bytes = bytes;
+    pool_unlock();
+    reclaim_images();
+}
+
+// Make pools without custom allocator use mp_image_hugepage_alloc().
+// This is a process-wide setting. This function is thread-safe.
+void mp_image_pool_set_hugepages(bool enable)
+{
+    atomic_store(&use_hugepages, enable);
+}
+
+// Whether mp_image_pool_set_hugepages() enabled huge pages.
+bool mp_image_pool_get_hugepages(void)
+{
+    return atomic_load(&use_hugepages);
+}
+
+#define HUGEPAGE_SIZE_LOG2 21
+#define HUGEPAGE_SIZE (1 << HUGEPAGE_SIZE_LOG2)
+
+// MAP_HUGETLB alone uses the system's default huge page size, which may be
+// larger (e.g. 1 GiB) and would waste most of the mapping. Only use explicit
+// huge pages if the page size can be requested.
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+#define HUGETLB_FLAGS (MAP_HUGETLB | (HUGEPAGE_SIZE_LOG2 << MAP_HUGE_SHIFT))
+#endif
+
+#if HAVE_POSIX
+static void free_mapping(void *opaque, uint8_t *data)
+{
+    // Only fails if the size is wrong, which would leak the mapping.
+    int ret = munmap(data, (uintptr_t)opaque);
+    assert(ret == 0);
+    (void)ret;
+}
+#endif
+
+// An mp_image_allocator (data is unused) for large images, which allocates
+// them from huge pages to reduce TLB misses. Explicit 2 MiB huge pages
+// (hugetlbfs) are used if the system has some reserved, otherwise transparent huge pages
+// are requested. Pages are only backed with memory when the image is first
+// written to, which normally happens on the node of the decoding or filtering
+// thread on NUMA systems. Falls back to mp_image_alloc() for images smaller
+// than a huge page, or if the memory can't be mapped.
+struct mp_image *mp_image_hugepage_alloc(void *data, int fmt, int w, int h)
+{
+#if HAVE_POSIX
+    int align = MP_IMAGE_BYTE_ALIGN;
+    int size = mp_image_get_alloc_size(fmt, w, h, align);
+    if (size < HUGEPAGE_SIZE || size > INT_MAX - HUGEPAGE_SIZE)
+        return mp_image_alloc(fmt, w, h);
+    size_t map_size = MP_ALIGN_UP((size_t)size, HUGEPAGE_SIZE);
+
+    void *ptr = MAP_FAILED;
+#ifdef HUGETLB_FLAGS
+    ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | HUGETLB_FLAGS, -1, 0);
+#endif
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            return mp_image_alloc(fmt, w, h);
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, map_size, MADV_HUGEPAGE);
+#endif
+    }
+
+    struct mp_image *img = mp_image_from_buffer(fmt, w, h, align, ptr, map_size,
+                                                (void *)(uintptr_t)map_size,
+                                                free_mapping);
+    if (!img)
+        munmap(ptr, map_size);
+    return img;
+#else
+    return mp_image_alloc(fmt, w, h);
+#endif
+}
+
+// Report the memory used by all pools, total and per image format.
+// This function is thread-safe.
+void mp_image_pool_report_stats(struct stats_ctx *ctx)
+{
+    struct fmt_stats { int fmt; size_t bytes, idle; } fmts[MP_ARRAY_SIZE(reported_fmts)];
+    int num_fmts = 0;
+    size_t total = 0, idle = 0, largest = 0;
+
+    pool_lock();
+    for (int p = 0; p < num_all_pools; p++) {
+        struct mp_image_pool *pool = all_pools[p];
+        largest = MPMAX(largest, pool->bytes);
+        for (int n = 0; n < pool->num_images; n++) {
+            struct mp_image *img = pool->images[n];
+            struct image_flags *it = img->priv;
+            int i = 0;
+            while (i < num_fmts && fmts[i].fmt != img->imgfmt)
+                i++;
+            if (i == num_fmts) {
+                if (num_fmts == MP_ARRAY_SIZE(fmts))
+                    continue;
+                fmts[num_fmts++] = (struct fmt_stats){ .fmt = img->imgfmt };
+            }
+            fmts[i].bytes += it->size;
+            total += it->size;
+            if (!it->referenced) {
+                fmts[i].idle += it->size;
+                idle += it->size;
+            }
+        }
+    }
+
+    // Formats no longer in use are reported as 0.
+    for (int n = 0; n < num_reported_fmts; n++) {
+        int i = 0;
+        while (i < num_fmts && fmts[i].fmt != reported_fmts[n])
+            i++;
+        if (i == num_fmts && num_fmts < MP_ARRAY_SIZE(fmts))
+            fmts[num_fmts++] = (struct fmt_stats){ .fmt = reported_fmts[n] };
+    }
+    num_reported_fmts = 0;
+    for (int n = 0; n < num_fmts; n++) {
+        if (fmts[n].bytes)
+            reported_fmts[num_reported_fmts++] = fmts[n].fmt;
+    }
+    int num_pools = num_all_pools;
+    pool_unlock();
+
+    stats_value(ctx, "pools", num_pools);
+    stats_size_value(ctx, "total", total);
+    stats_size_value(ctx, "idle", idle);
+    stats_size_value(ctx, "largest-pool", largest);
+    for (int n = 0; n < num_fmts; n++) {
+        const char *name = mp_imgfmt_to_name(fmts[n].fmt);
+        stats_size_value(ctx, name, fmts[n].bytes);
+        stats_size_value(ctx, mp_tprintf(32, "%s-idle", name), fmts[n].idle);
     }
-    pool->num_images = 0;
 }
 
 // This is the only function that is allowed to run in a different thread.
@@ -140,13 +381,20 @@ struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
             }
         }
     }
+    if (new) {
+        // Mark it as referenced while still locked, so that it can't be
+        // reclaimed by other threads.
+        struct image_flags *it = new->priv;
+        assert(!it->referenced && it->pool_alive);
+        it->referenced = true;
+        it->order = ++pool->lru_counter;
+        it->last_used = ++use_counter;
+    }
     pool_unlock();
     if (!new)
         return NULL;
 
-    // Reference the new image. Since mp_image_pool is not declared thread-safe,
-    // and unreffing images from other threads does not allocate new images,
-    // no synchronization is required here.
+    // Reference the new image.
     for (int p = 0; p < MP_MAX_PLANES; p++)
         assert(!!new->bufs[p] == !p); // only 1 AVBufferRef
 
@@ -160,22 +408,26 @@ struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
                                     unref_image, new, flags);
     if (!ref->bufs[0]) {
         talloc_free(ref);
+        unref_image(new, NULL);
         return NULL;
     }
 
-    struct image_flags *it = new->priv;
-    assert(!it->referenced && it->pool_alive);
-    it->referenced = true;
-    it->order = ++pool->lru_counter;
     return ref;
 }
 
 void mp_image_pool_add(struct mp_image_pool *pool, struct mp_image *new)
 {
     struct image_flags *it = talloc_ptrtype(new, it);
-    *it = (struct image_flags) { .pool_alive = true };
+    *it = (struct image_flags) {
+        .pool_alive = true,
+        .size = new->bufs[0] ? new->bufs[0]->size : 0,
+    };
     new->priv = it;
+    pool_lock();
     MP_TARRAY_APPEND(pool, pool->images, pool->num_images, new);
+    pool->bytes += it->size;
+    total_bytes += it->size;
+    pool_unlock();
 }
 
 // Return a new image of given format/size. The only difference to
@@ -198,13 +450,22 @@ struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
         pool->h = h;
         if (pool->allocator) {
             new = pool->allocator(pool->allocator_ctx, fmt, w, h);
+        } else if (atomic_load(&use_hugepages)) {
+            new = mp_image_hugepage_alloc(NULL, fmt, w, h);
         } else {
             new = mp_image_alloc(fmt, w, h);
         }
         if (!new)
             return NULL;
         mp_image_pool_add(pool, new);
+        if (!pool->allocator || pool->allocator == mp_image_hugepage_alloc) {
+            struct image_flags *it = new->priv;
+            pool_lock();
+            it->reclaimable = true;
+            pool_unlock();
+        }
         new = mp_image_pool_get_no_alloc(pool, fmt, w, h);
+        reclaim_images();
     }
     return new;
 }
@@ -2,8 +2,10 @@
 #define MPV_MP_IMAGE_POOL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct mp_image_pool;
+struct stats_ctx;
 
 struct mp_image_pool *mp_image_pool_new(void *tparent);
 struct mp_image *mp_image_pool_get(struct mp_image_pool *pool, int fmt,
@@ -14,6 +16,11 @@ void mp_image_pool_clear(struct mp_image_pool *pool);
 
 void mp_image_pool_set_lru(struct mp_image_pool *pool);
 
+void mp_image_pool_set_max_bytes(size_t bytes);
+void mp_image_pool_set_hugepages(bool enable);
+bool mp_image_pool_get_hugepages(void);
+void mp_image_pool_report_stats(struct stats_ctx *ctx);
+
 struct mp_image *mp_image_pool_get_no_alloc(struct mp_image_pool *pool, int fmt,
                                             int w, int h);
 
@@ -21,6 +28,8 @@ typedef struct mp_image *(*mp_image_allocator)(void *data, int fmt, int w, int h
 void mp_image_pool_set_allocator(struct mp_image_pool *pool,
                                  mp_image_allocator cb, void  *cb_data);
 
+struct mp_image *mp_image_hugepage_alloc(void *data, int fmt, int w, int h);
+
 struct mp_image *mp_image_pool_new_copy(struct mp_image_pool *pool,
                                         struct mp_image *img);
 bool mp_image_pool_make_writeable(struct mp_image_pool *pool,
@@ -1,18 +1,54 @@
+#include <libavutil/cpu.h>
+
 #include "libmpv/render_gl.h"
 #include "libmpv.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
+#include "options/m_config.h"
+#include "options/options.h"
 #include "sub/osd.h"
 #include "video/sws_utils.h"
 
+// Minimum number of lines each thread scales with --libmpv-sw-threads.
+#define MIN_SLICE_LINES 32
+
+// With vertical chroma subsampling, stripes are converted with this many extra
+// lines above and below, which are cropped afterwards. This covers the vertical
+// chroma filter of all libswscale scalers with default parameters, and is a
+// multiple of the 8 line ordered dither pattern.
+#define SLICE_CONTEXT_LINES 32
+
+// Horizontal stripe of the video, scaled or copied by one thread.
+struct render_slice {
+    struct priv *p;
+    struct mp_sws_context *sws;
+    struct mp_image src, dst;
+    bool direct;
+    struct mp_image *tmp;   // if set, src is converted to this first
+    int tmp_y;              // line in tmp that corresponds to dst line 0
+    int res;
+    struct mp_waiter waiter;
+};
+
 struct priv {
     struct libmpv_gpu_context *context;
 
     struct mp_sws_context *sws;
     struct osd_state *osd;
+    struct m_config_cache *opts_cache;
 
     struct mp_image_params src_params, dst_params;
     struct mp_rect src_rc, dst_rc;
     struct mp_osd_res osd_rc;
     bool anything_changed;
+
+    // Source and destination have the same format and colorspace, so the
+    // video can be copied if it is not scaled.
+    bool direct;
+
+    struct mp_thread_pool *tp;
+    struct render_slice *slices;    // slices[0] uses sws
+    int num_threads;
 };
 
 static int init(struct render_backend *ctx, mpv_render_param *params)
@@ -29,6 +65,11 @@ static int init(struct render_backend *ctx, mpv_render_param *params)
 
     p->sws = mp_sws_alloc(p);
     mp_sws_enable_cmdline_opts(p->sws, ctx->global);
+    p->opts_cache = m_config_cache_alloc(p, ctx->global, &vo_sub_opts);
+
+    p->num_threads = 1;
+    p->slices = talloc_zero_array(p, struct render_slice, 1);
+    p->slices[0] = (struct render_slice){.p = p, .sws = p->sws};
 
     p->anything_changed = true;
 
@@ -93,6 +134,151 @@ static int get_target_size(struct render_backend *ctx, mpv_render_param *params,
     return 0;
 }
 
+static void setup_threads(struct render_backend *ctx)
+{
+    struct priv *p = ctx->priv;
+    struct mp_vo_opts *opts = p->opts_cache->opts;
+
+    int threads = opts->libmpv_sw_threads;
+    if (!threads)
+        threads = av_cpu_count();
+    threads = MPCLAMP(threads, 1, 64);
+    threads = MPMAX(MPMIN(threads, mp_rect_h(p->dst_rc) / MIN_SLICE_LINES), 1);
+
+    if (threads == p->num_threads)
+        return;
+
+    TA_FREEP(&p->tp);
+    for (int n = 1; n < p->num_threads; n++)
+        talloc_free(p->slices[n].sws);
+    for (int n = 0; n < p->num_threads; n++)
+        TA_FREEP(&p->slices[n].tmp);
+    p->num_threads = 1;
+    if (threads > 1) {
+        p->tp = mp_thread_pool_create(p, threads - 1, threads - 1, threads - 1);
+        if (!p->tp)
+            return;
+    }
+
+    p->slices = talloc_realloc(p, p->slices, struct render_slice, threads);
+    for (int n = p->num_threads; n < threads; n++) {
+        struct mp_sws_context *sws = mp_sws_alloc(p);
+        mp_sws_enable_cmdline_opts(sws, ctx->global);
+        // zimg does its own slicing with its own threads.
+        sws->force_scaler = MP_SWS_SWS;
+        p->slices[n] = (struct render_slice){.p = p, .sws = sws};
+    }
+    p->num_threads = threads;
+}
+
+static void render_slice(struct render_slice *s)
+{
+    s->res = 0;
+    if (!s->dst.h)
+        return;
+
+    if (s->direct) {
+        mp_image_copy(&s->dst, &s->src);
+    } else if (s->tmp) {
+        s->res = mp_sws_scale(s->sws, s->tmp, &s->src);
+        struct mp_image part = *s->tmp;
+        mp_image_crop(&part, 0, s->tmp_y, part.w, s->tmp_y + s->dst.h);
+        if (s->res >= 0)
+            mp_image_copy(&s->dst, &part);
+    } else {
+        s->res = mp_sws_scale(s->sws, &s->dst, &s->src);
+    }
+}
+
+static void render_slice_thread(void *ptr)
+{
+    struct render_slice *s = ptr;
+
+    render_slice(s);
+    mp_waiter_wakeup(&s->waiter, 0);
+}
+
+// Scale src to dst. Without vertical scaling, source lines map to destination
+// lines, and the video can be split into stripes for each thread. swscale
+// interpolates vertically subsampled chroma across lines, so independent
+// stripes would show seams. Such stripes are converted with context lines into
+// a temporary image instead, and only the stripe's own lines are copied.
+static int scale_video(struct priv *p, struct mp_image *dst,
+                       struct mp_image *src)
+{
+    bool direct = p->direct && src->w == dst->w && src->h == dst->h;
+    bool context = !direct && (src->fmt.chroma_ys || dst->fmt.chroma_ys);
+    int slices = 1;
+    if (src->h == dst->h && (direct || !p->sws->zimg_ok))
+        slices = p->num_threads;
+
+    // Stripes must start on a chroma line, and at the same dither line.
+    int align = src->fmt.align_y;
+    if (context) {
+        slices = MPMIN(slices, dst->h / (4 * SLICE_CONTEXT_LINES));
+        align = MP_ALIGN_UP(8, align);
+    }
+    slices = MPMAX(slices, 1);
+
+    int lines = MP_ALIGN_UP((dst->h + slices - 1) / slices, align);
+
+    for (int n = 0; n < slices; n++) {
+        struct render_slice *s = &p->slices[n];
+        int y0 = MPMIN(n * lines, dst->h);
+        int y1 = MPMIN(y0 + lines, dst->h);
+
+        s->direct = direct;
+        s->src = *src;
+        s->dst = *dst;
+        if (slices > 1 && context) {
+            int c0 = MPMAX(y0 - SLICE_CONTEXT_LINES, 0);
+            int c1 = MPMIN(y1 + SLICE_CONTEXT_LINES, dst->h);
+            struct mp_image *tmp = s->tmp;
+            if (!tmp || tmp->imgfmt != dst->imgfmt || tmp->w != dst->w ||
+                tmp->h != c1 - c0)
+            {
+                talloc_free(s->tmp);
+                s->tmp = tmp = mp_image_alloc(dst->imgfmt, dst->w, c1 - c0);
+                talloc_steal(p, tmp);
+                if (!tmp)
+                    return -1;
+            }
+            mp_image_copy_attributes(tmp, dst);
+            mp_image_crop(&s->src, 0, c0, src->w, c1);
+            mp_image_crop(&s->dst, 0, y0, dst->w, y1);
+            s->tmp_y = y0 - c0;
+        } else {
+            TA_FREEP(&s->tmp);
+            if (slices > 1) {
+                mp_image_crop(&s->src, 0, y0, src->w, y1);
+                mp_image_crop(&s->dst, 0, y0, dst->w, y1);
+            }
+        }
+    }
+
+    for (int n = 1; n < slices; n++) {
+        struct render_slice *s = &p->slices[n];
+
+        s->waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+
+        bool r = mp_thread_pool_run(p->tp, render_slice_thread, s);
+        // The pool has a thread for each slice, and they're all idle here.
+        assert(r);
+    }
+
+    render_slice(&p->slices[0]);
+    int res = p->slices[0].res;
+
+    for (int n = 1; n < slices; n++) {
+        struct render_slice *s = &p->slices[n];
+
+        mp_waiter_wait(&s->waiter);
+        res = MPMIN(res, s->res);
+    }
+
+    return res;
+}
+
 static int render(struct render_backend *ctx, mpv_render_param *params,
                   struct vo_frame *frame)
 {
@@ -113,6 +299,9 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
     if (sz[0] != p->dst_params.w || sz[1] != p->dst_params.h)
         p->anything_changed = true;
 
+    if (m_config_cache_update(p->opts_cache))
+        p->anything_changed = true;
+
     if (p->anything_changed) {
         p->dst_params = (struct mp_image_params){
             .imgfmt = mp_imgfmt_from_name(bstr0(fmt)),
@@ -145,8 +334,18 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
 
             if (mp_sws_reinit(p->sws) < 0)
                 return MPV_ERROR_UNSUPPORTED; // probably
+
+            struct mp_image_params src = p->src_params;
+            mp_image_params_guess_csp(&src);
+            p->direct = src.imgfmt == p->dst_params.imgfmt &&
+                        pl_color_space_equal(&src.color, &p->dst_params.color) &&
+                        pl_color_repr_equal(&src.repr, &p->dst_params.repr);
+            if (p->direct)
+                MP_VERBOSE(ctx, "Formats match, copying video.\n");
         }
 
+        setup_threads(ctx);
+
         p->anything_changed = false;
     }
 
@@ -175,7 +374,7 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
         struct mp_image dst = wrap_img;
         mp_image_crop_rc(&dst, p->dst_rc);
 
-        if (mp_sws_scale(p->sws, &dst, &src) < 0) {
+        if (scale_video(p, &dst, &src) < 0) {
             mp_image_clear(&wrap_img, 0, 0, wrap_img.w, wrap_img.h);
             return MPV_ERROR_GENERIC;
         }
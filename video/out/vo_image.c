@@ -22,9 +22,12 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 
 #include "misc/bstr.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "osdep/io.h"
 #include "options/m_config.h"
 #include "options/path.h"
@@ -49,6 +52,7 @@ static const struct m_sub_options image_writer_conf = {
 struct vo_image_opts {
     struct image_writer_opts *opts;
     char *outdir;
+    int parallel;
 };
 
 #define OPT_BASE_STRUCT struct vo_image_opts
@@ -57,9 +61,23 @@ static const struct m_sub_options vo_image_conf = {
     .opts = (const struct m_option[]) {
         {"vo-image", OPT_SUBSTRUCT(opts, image_writer_conf)},
         {"vo-image-outdir", OPT_STRING(outdir), .flags = M_OPT_FILE},
+        {"vo-image-parallel", OPT_CHOICE(parallel, {"auto", 0}),
+            M_RANGE(1, 64)},
         {0},
     },
     .size = sizeof(struct vo_image_opts),
+    .defaults = &(const struct vo_image_opts){
+        .parallel = 1,
+    },
+};
+
+// A frame being written on the thread pool.
+struct image_job {
+    struct vo *vo;
+    struct mp_image *image;
+    char *filename;
+    bool ok;
+    struct mp_waiter waiter;
 };
 
 struct priv {
@@ -67,6 +85,12 @@ struct priv {
 
     struct mp_image *current;
     int frame;
+
+    // Parallel writing. jobs[] is in frame order.
+    struct mp_thread_pool *tp;
+    int max_jobs;
+    struct image_job **jobs;
+    int num_jobs;
 };
 
 static bool checked_mkdir(struct vo *vo, const char *buf)
@@ -85,6 +109,30 @@ static bool checked_mkdir(struct vo *vo, const char *buf)
     return true;
 }
 
+static void write_job(void *ptr)
+{
+    struct image_job *job = ptr;
+    struct priv *p = job->vo->priv;
+
+    job->ok = write_image(job->image, p->opts->opts, job->filename,
+                          job->vo->global, job->vo->log, true);
+    mp_waiter_wakeup(&job->waiter, 0);
+}
+
+// Wait until the oldest frame was written.
+static void finish_job(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+    assert(p->num_jobs);
+
+    struct image_job *job = p->jobs[0];
+    mp_waiter_wait(&job->waiter);
+    if (!job->ok)
+        MP_ERR(vo, "Failed to write %s\n", job->filename);
+    talloc_free(job);
+    MP_TARRAY_REMOVE_AT(p->jobs, p->num_jobs, 0);
+}
+
 static int reconfig(struct vo *vo, struct mp_image_params *params)
 {
     return 0;
@@ -121,7 +169,26 @@ static void flip_page(struct vo *vo)
         filename = mp_path_join(t, p->opts->outdir, filename);
 
     MP_INFO(vo, "Saving %s\n", filename);
-    write_image(p->current, p->opts->opts, filename, vo->global, vo->log, true);
+
+    struct mp_image *image = p->tp ? mp_image_new_ref(p->current) : NULL;
+    if (!image) {
+        write_image(p->current, p->opts->opts, filename, vo->global, vo->log, true);
+        talloc_free(t);
+        return;
+    }
+
+    // Block the VO if too many frames are still being written.
+    while (p->num_jobs >= p->max_jobs)
+        finish_job(vo);
+
+    struct image_job *job = talloc_zero(p, struct image_job);
+    job->vo = vo;
+    job->image = talloc_steal(job, image);
+    job->filename = talloc_steal(job, filename);
+    job->waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+    MP_TARRAY_APPEND(p, p->jobs, p->num_jobs, job);
+
+    mp_thread_pool_queue(p->tp, write_job, job);
 
     talloc_free(t);
 }
@@ -135,6 +202,10 @@ static int query_format(struct vo *vo, int fmt)
 
 static void uninit(struct vo *vo)
 {
+    struct priv *p = vo->priv;
+
+    while (p->num_jobs)
+        finish_job(vo);
 }
 
 static int preinit(struct vo *vo)
@@ -143,6 +214,18 @@ static int preinit(struct vo *vo)
     p->opts = mp_get_config_group(vo, vo->global, &vo_image_conf);
     if (p->opts->outdir && !checked_mkdir(vo, p->opts->outdir))
         return -1;
+
+    int threads = p->opts->parallel;
+    if (threads < 1)
+        threads = av_cpu_count();
+    if (threads > 1) {
+        p->tp = mp_thread_pool_create(p, threads, threads, threads);
+        if (!p->tp)
+            MP_WARN(vo, "Failed to create threads, writing serially.\n");
+        // Each thread works on a frame, and each thread gets one more frame
+        // queued, so it can start on it right away.
+        p->max_jobs = threads * 2;
+    }
     return 0;
 }
 
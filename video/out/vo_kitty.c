@@ -33,7 +33,10 @@
 
 #include <libswscale/swscale.h>
 #include <libavutil/base64.h>
+#include <libavutil/cpu.h>
 
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "options/m_config.h"
 #include "osdep/terminal.h"
 #include "sub/osd.h"
@@ -48,6 +51,10 @@
 #define DEFAULT_WIDTH 80
 #define DEFAULT_HEIGHT 25
 
+// Approximate size of a tile with --vo-kitty-dirty-regions, in pixels. Tiles
+// are always a multiple of the cell size.
+#define TILE_SIZE 64
+
 static inline void write_str(const char *s)
 {
     // On POSIX platforms, write() is the fastest method. It also is the only
@@ -73,6 +80,7 @@ static inline void write_str(const char *s)
 
 #define KITTY_ESC_IMG        "\033_Ga=T,f=24,s=%d,v=%d,C=1,q=2,m=1;"
 #define KITTY_ESC_IMG_SHM    "\033_Ga=T,t=s,f=24,s=%d,v=%d,C=1,q=2,m=1;%s\033\\"
+#define KITTY_ESC_IMG_TILE   "\033_Ga=T,f=24,i=%d,p=1,s=%d,v=%d,C=1,q=2,m=1;"
 #define KITTY_ESC_CONTINUE   "\033_Gm=%d;"
 #define KITTY_ESC_END        "\033\\"
 #define KITTY_ESC_DELETE_ALL "\033_Ga=d;\033\\"
@@ -81,6 +89,23 @@ struct vo_kitty_opts {
     int width, height, top, left, rows, cols;
     bool config_clear, alt_screen;
     bool use_shm;
+    int threads;
+    bool dirty_regions;
+};
+
+// Part of the image that is base64 encoded by one thread. Without
+// --vo-kitty-dirty-regions, these are horizontal stripes, whose output is
+// contiguous.
+struct tile {
+    int x, y, w, h;     // in pixels
+    char *out;          // base64 output, w * h * 4 chars
+    bool dirty;         // changed since the previous frame
+};
+
+struct encode_thread {
+    struct priv *p;
+    int index;
+    struct mp_waiter waiter;
 };
 
 struct priv {
@@ -99,6 +124,19 @@ struct priv {
     struct mp_osd_res osd;
     struct mp_image *frame;
     struct mp_sws_context *sws;
+
+    // For --vo-kitty-dirty-regions.
+    bool use_dirty;
+    bool full_redraw;
+    struct mp_image *prev_frame;    // what was sent to the terminal last
+    int cell_w, cell_h;             // in pixels
+
+    struct tile *tiles;
+    int num_tiles;
+
+    struct mp_thread_pool *tp;
+    struct encode_thread *threads;
+    int num_threads;
 };
 
 #if HAVE_POSIX
@@ -125,7 +163,13 @@ static void free_bufs(struct vo* vo)
     struct priv* p = vo->priv;
 
     talloc_free(p->frame);
+    talloc_free(p->prev_frame);
     talloc_free(p->output);
+    talloc_free(p->tiles);
+    p->frame = p->prev_frame = NULL;
+    p->output = NULL;
+    p->tiles = NULL;
+    p->num_tiles = 0;
 
     if (p->opts.use_shm) {
         close_shm(p);
@@ -165,7 +209,52 @@ static void set_out_params(struct vo *vo)
         p->opts.left : p->cols * p->dst.x0 / vo->dwidth;
 
     p->buffer_size = 3 * p->width * p->height;
-    p->output_size = AV_BASE64_SIZE(p->buffer_size);
+    p->output_size = 4 * p->width * p->height;
+}
+
+// Split the image into the parts encoded by the threads.
+static void setup_tiles(struct vo *vo)
+{
+    struct priv *p = vo->priv;
+
+    p->cell_w = p->cols > 0 ? vo->dwidth / p->cols : 0;
+    p->cell_h = p->rows > 0 ? vo->dheight / p->rows : 0;
+    p->use_dirty = p->opts.dirty_regions && p->cell_w > 0 && p->cell_h > 0;
+
+    if (p->use_dirty) {
+        int tile_w = p->cell_w * MPMAX(TILE_SIZE / p->cell_w, 1);
+        int tile_h = p->cell_h * MPMAX(TILE_SIZE / p->cell_h, 1);
+        for (int y = 0; y < p->height; y += tile_h) {
+            for (int x = 0; x < p->width; x += tile_w) {
+                struct tile tile = {
+                    .x = x,
+                    .y = y,
+                    .w = MPMIN(tile_w, p->width - x),
+                    .h = MPMIN(tile_h, p->height - y),
+                };
+                MP_TARRAY_APPEND(NULL, p->tiles, p->num_tiles, tile);
+            }
+        }
+    } else {
+        int lines = (p->height + p->num_threads - 1) / p->num_threads;
+        for (int y = 0; y < p->height; y += lines) {
+            struct tile tile = {
+                .w = p->width,
+                .y = y,
+                .h = MPMIN(lines, p->height - y),
+            };
+            MP_TARRAY_APPEND(NULL, p->tiles, p->num_tiles, tile);
+        }
+    }
+
+    // Tiles cover the image without overlapping, so the output of all of them
+    // fits in the buffer for the full image.
+    char *out = p->output;
+    for (int n = 0; n < p->num_tiles; n++) {
+        p->tiles[n].out = out;
+        out += 4 * p->tiles[n].w * p->tiles[n].h;
+    }
+    assert(out == p->output + p->output_size);
 }
 
 static int reconfig(struct vo *vo, struct mp_image_params *params)
@@ -200,13 +289,94 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
         return -1;
 
     if (!p->opts.use_shm) {
-        p->buffer = talloc_array(NULL, uint8_t, p->buffer_size);
         p->output = talloc_array(NULL, char, p->output_size);
+        setup_tiles(vo);
+        if (p->use_dirty) {
+            p->prev_frame = mp_image_alloc(IMGFMT, p->width, p->height);
+            if (!p->prev_frame) {
+                TA_FREEP(&p->output);
+                return -1;
+            }
+        }
+        p->full_redraw = true;
     }
 
     return 0;
 }
 
+static const char base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Like av_base64_encode(), but size must be a multiple of 3, and the output
+// is not 0-terminated, so that threads can write adjacent parts of a buffer.
+static void encode_base64(char *out, const uint8_t *in, int size)
+{
+    for (int i = 0; i < size; i += 3) {
+        uint32_t v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        *out++ = base64_chars[v >> 18];
+        *out++ = base64_chars[(v >> 12) & 63];
+        *out++ = base64_chars[(v >> 6) & 63];
+        *out++ = base64_chars[v & 63];
+    }
+}
+
+static bool tile_changed(struct priv *p, struct tile *tile)
+{
+    for (int y = tile->y; y < tile->y + tile->h; y++) {
+        if (memcmp(mp_image_pixel_ptr(p->frame, 0, tile->x, y),
+                   mp_image_pixel_ptr(p->prev_frame, 0, tile->x, y),
+                   tile->w * BYTES_PER_PX))
+            return true;
+    }
+    return false;
+}
+
+static void encode_tile(struct priv *p, struct tile *tile)
+{
+    tile->dirty = !p->use_dirty || p->full_redraw || tile_changed(p, tile);
+    if (!tile->dirty)
+        return;
+
+    // Each line is a multiple of 3 bytes, so it can be encoded on its own.
+    for (int y = 0; y < tile->h; y++) {
+        encode_base64(tile->out + 4 * tile->w * y,
+                      mp_image_pixel_ptr(p->frame, 0, tile->x, tile->y + y),
+                      tile->w * BYTES_PER_PX);
+    }
+}
+
+static void encode_tiles(struct priv *p, int index)
+{
+    for (int n = index; n < p->num_tiles; n += p->num_threads)
+        encode_tile(p, &p->tiles[n]);
+}
+
+static void encode_tiles_thread(void *ptr)
+{
+    struct encode_thread *t = ptr;
+
+    encode_tiles(t->p, t->index);
+    mp_waiter_wakeup(&t->waiter, 0);
+}
+
+static void encode_frame(struct priv *p)
+{
+    for (int n = 1; n < p->num_threads; n++) {
+        struct encode_thread *t = &p->threads[n];
+
+        t->waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+
+        bool r = mp_thread_pool_run(p->tp, encode_tiles_thread, t);
+        // The pool has a thread for each encode_thread, and they're all idle.
+        assert(r);
+    }
+
+    encode_tiles(p, 0);
+
+    for (int n = 1; n < p->num_threads; n++)
+        mp_waiter_wait(&p->threads[n].waiter);
+}
+
 static int create_shm(struct vo *vo)
 {
 #if HAVE_POSIX_SHM
@@ -272,49 +442,69 @@ static bool draw_frame(struct vo *vo, struct vo_frame *frame)
     osd_draw_on_image(vo->osd, res, mpi ? mpi->pts : 0, 0, p->frame);
 
 
-    if (p->opts.use_shm && !create_shm(vo))
-        goto done;
-
-    memcpy_pic(p->buffer, p->frame->planes[0], p->width * BYTES_PER_PX,
-               p->height, p->width * BYTES_PER_PX, p->frame->stride[0]);
-
-    if (!p->opts.use_shm)
-        av_base64_encode(p->output, p->output_size, p->buffer, p->buffer_size);
+    if (p->opts.use_shm) {
+        if (create_shm(vo)) {
+            memcpy_pic(p->buffer, p->frame->planes[0], p->width * BYTES_PER_PX,
+                       p->height, p->width * BYTES_PER_PX, p->frame->stride[0]);
+        }
+    } else if (p->output) {
+        encode_frame(p);
+        if (p->use_dirty)
+            MPSWAP(struct mp_image *, p->frame, p->prev_frame);
+        p->full_redraw = false;
+    }
 
     talloc_free(mpi);
 
-done:
     return VO_TRUE;
 }
 
+static char *append_image_data(char *cmd, const char *data, int size)
+{
+    for (int offset = 0, noffset;; offset += noffset) {
+        if (offset)
+            cmd = talloc_asprintf_append(cmd, KITTY_ESC_CONTINUE, offset < size);
+        noffset = MPMIN(4096, size - offset);
+        cmd = talloc_strndup_append(cmd, data + offset, noffset);
+        cmd = talloc_strdup_append(cmd, KITTY_ESC_END);
+
+        if (offset >= size)
+            break;
+    }
+    return cmd;
+}
+
 static void flip_page(struct vo *vo)
 {
     struct priv* p = vo->priv;
 
-    if (p->buffer == NULL)
+    if (p->opts.use_shm ? p->buffer == NULL : p->output == NULL)
         return;
 
-    char *cmd = talloc_asprintf(NULL, TERM_ESC_GOTO_YX, p->top, p->left);
+    char *cmd = NULL;
 
     if (p->opts.use_shm) {
+        cmd = talloc_asprintf(NULL, TERM_ESC_GOTO_YX, p->top, p->left);
         cmd = talloc_asprintf_append(cmd, KITTY_ESC_IMG_SHM, p->width, p->height, p->shm_path_b64);
-    } else {
-        if (p->output == NULL) {
-            talloc_free(cmd);
-            return;
+    } else if (p->use_dirty) {
+        // Each tile is a separate image, placed at its cell. Sending a tile
+        // with the same image and placement ID replaces the previous one.
+        cmd = talloc_strdup(NULL, "");
+        for (int n = 0; n < p->num_tiles; n++) {
+            struct tile *tile = &p->tiles[n];
+            if (!tile->dirty)
+                continue;
+            cmd = talloc_asprintf_append(cmd, TERM_ESC_GOTO_YX,
+                                         MPMAX(p->top, 1) + tile->y / p->cell_h,
+                                         MPMAX(p->left, 1) + tile->x / p->cell_w);
+            cmd = talloc_asprintf_append(cmd, KITTY_ESC_IMG_TILE, n + 1,
+                                         tile->w, tile->h);
+            cmd = append_image_data(cmd, tile->out, 4 * tile->w * tile->h);
         }
-
+    } else {
+        cmd = talloc_asprintf(NULL, TERM_ESC_GOTO_YX, p->top, p->left);
         cmd = talloc_asprintf_append(cmd, KITTY_ESC_IMG, p->width, p->height);
-        for (int offset = 0, noffset;; offset += noffset) {
-            if (offset)
-                cmd = talloc_asprintf_append(cmd, KITTY_ESC_CONTINUE, offset < p->output_size);
-            noffset = MPMIN(4096, p->output_size - offset);
-            cmd = talloc_strndup_append(cmd, p->output + offset, noffset);
-            cmd = talloc_strdup_append(cmd, KITTY_ESC_END);
-
-            if (offset >= p->output_size)
-                break;
-        }
+        cmd = append_image_data(cmd, p->output, p->output_size);
     }
 
     write_str(cmd);
@@ -342,6 +532,18 @@ static int preinit(struct vo *vo)
     p->sws->log = vo->log;
     mp_sws_enable_cmdline_opts(p->sws, vo->global);
 
+    int threads = p->opts.threads ? p->opts.threads : av_cpu_count();
+    threads = MPCLAMP(threads, 1, 64);
+    if (threads > 1 && !p->opts.use_shm) {
+        p->tp = mp_thread_pool_create(vo, threads - 1, threads - 1, threads - 1);
+        if (p->tp)
+            MP_VERBOSE(vo, "using %d threads for encoding\n", threads);
+    }
+    p->num_threads = p->tp ? threads : 1;
+    p->threads = talloc_zero_array(vo, struct encode_thread, p->num_threads);
+    for (int n = 0; n < p->num_threads; n++)
+        p->threads[n] = (struct encode_thread){.p = p, .index = n};
+
 #if HAVE_POSIX
     struct sigaction sa = {
         .sa_handler = handle_winch,
@@ -433,6 +635,8 @@ const struct vo_driver video_out_kitty = {
         {"config-clear", OPT_BOOL(opts.config_clear), },
         {"alt-screen", OPT_BOOL(opts.alt_screen), },
         {"use-shm", OPT_BOOL(opts.use_shm), },
+        {"threads", OPT_CHOICE(opts.threads, {"auto", 0}), M_RANGE(1, 64)},
+        {"dirty-regions", OPT_BOOL(opts.dirty_regions), },
         {0}
     },
     .options_prefix = "vo-kitty",
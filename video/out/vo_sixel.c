@@ -24,10 +24,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 #include <sixel.h>
 
 #include "config.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "options/m_config.h"
 #include "osdep/terminal.h"
 #include "sub/osd.h"
@@ -54,6 +57,18 @@ struct vo_sixel_opts {
     int rows, cols;
     bool config_clear, alt_screen;
     bool buffered;
+    int threads;
+};
+
+// Horizontal part of the image, encoded as separate sixel image by one thread.
+struct sixel_band {
+    struct priv *priv;
+    int y, h;                   // in pixels
+    sixel_dither_t *dither;     // copy of priv->dither
+    int palette_gen;            // priv->palette_gen when dither was copied
+    sixel_output_t *output;
+    char *buf;                  // encoded image
+    struct mp_waiter waiter;
 };
 
 struct priv {
@@ -75,6 +90,14 @@ struct priv {
 
     int previous_histogram_colors;
 
+    int cell_height;  // in pixels
+    int palette_gen;  // incremented when priv->dither is replaced
+
+    struct mp_thread_pool *tp;
+    int num_threads;
+    struct sixel_band *bands;  // if NULL, the image is encoded as a whole
+    int num_bands;
+
     struct mp_rect src_rect;
     struct mp_rect dst_rect;
     struct mp_osd_res osd;
@@ -111,10 +134,26 @@ static int detect_scene_change(struct vo* vo)
 
 }
 
+static void dealloc_bands(struct priv *priv)
+{
+    for (int n = 0; n < priv->num_bands; n++) {
+        struct sixel_band *band = &priv->bands[n];
+        if (band->dither)
+            sixel_dither_unref(band->dither);
+        if (band->output)
+            sixel_output_unref(band->output);
+        talloc_free(band->buf);
+    }
+    TA_FREEP(&priv->bands);
+    priv->num_bands = 0;
+}
+
 static void dealloc_dithers_and_buffers(struct vo* vo)
 {
     struct priv* priv = vo->priv;
 
+    dealloc_bands(priv);
+
     if (priv->buffer) {
         talloc_free(priv->buffer);
         priv->buffer = NULL;
@@ -144,6 +183,7 @@ static SIXELSTATUS prepare_static_palette(struct vo* vo)
         priv->dither = sixel_dither_get(BUILTIN_XTERM256);
         if (priv->dither == NULL)
             return SIXEL_FALSE;
+        priv->palette_gen++;
 
         sixel_dither_set_diffusion_type(priv->dither, priv->opts.diffuse);
     }
@@ -174,6 +214,7 @@ static SIXELSTATUS prepare_dynamic_palette(struct vo *vo)
         }
 
         priv->dither = priv->testdither;
+        priv->palette_gen++;
         status = sixel_dither_new(&priv->testdither, priv->opts.reqcolors, NULL);
 
         if (SIXEL_FAILED(status))
@@ -254,6 +295,7 @@ static void update_canvas_dimensions(struct vo *vo)
 
     priv->num_rows = num_rows;
     priv->num_cols = num_cols;
+    priv->cell_height = total_px_height / num_rows;
 
     priv->canvas_ok = vo->dwidth > 0 && vo->dheight > 0;
 }
@@ -322,6 +364,107 @@ static int update_sixel_swscaler(struct vo *vo, struct mp_image_params *params)
     return 0;
 }
 
+static inline int sixel_buffer(char *data, int size, void *priv);
+
+// Split the image into bands that are encoded in parallel. Each band is drawn
+// at its own cell row, so its height must be a multiple of the cell height, as
+// well as of the sixel height of 6 pixels.
+static void setup_bands(struct vo *vo)
+{
+    struct priv *priv = vo->priv;
+
+    dealloc_bands(priv);
+
+    if (priv->num_threads < 2 || priv->cell_height <= 0)
+        return;
+
+    int a = 6, b = priv->cell_height;
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    int unit = 6 / a * priv->cell_height;
+    int units = (priv->height + unit - 1) / unit;
+    int band_h = unit * ((units + priv->num_threads - 1) / priv->num_threads);
+    if (band_h >= priv->height)
+        return;
+
+    int num_bands = (priv->height + band_h - 1) / band_h;
+    priv->bands = talloc_zero_array(NULL, struct sixel_band, num_bands);
+    for (int n = 0; n < num_bands; n++) {
+        struct sixel_band *band = &priv->bands[n];
+        band->priv = priv;
+        band->y = n * band_h;
+        band->h = MPMIN(band_h, priv->height - band->y);
+        // band->buf must not move, as sixel_buffer() appends to it.
+        SIXELSTATUS status = sixel_output_new(&band->output, sixel_buffer,
+                                              &band->buf, NULL);
+        if (SIXEL_FAILED(status)) {
+            MP_WARN(vo, "Failed to create sixel output, not using threads: %s\n",
+                    sixel_helper_format_error(status));
+            dealloc_bands(priv);
+            return;
+        }
+        sixel_output_set_encode_policy(band->output, SIXEL_ENCODEPOLICY_FAST);
+        priv->num_bands++;
+    }
+
+    MP_VERBOSE(vo, "encoding in %d bands of %d lines\n", num_bands, band_h);
+}
+
+// Make the band's dither use the current palette. The dither is recreated with a
+// full copy of the palette whenever priv->dither changes. Only the palette of
+// the first band is sent; the terminal uses it for all bands, as the color
+// registers are shared (TERM_ESC_USE_GLOBAL_COLOR_REG).
+// Whether a frame keeps the previous palette is decided by detect_scene_change()
+// alone; libsixel can't extend an existing palette with new colors.
+static SIXELSTATUS update_band_dither(struct priv *priv, struct sixel_band *band)
+{
+    if (band->dither && band->palette_gen == priv->palette_gen)
+        return SIXEL_OK;
+
+    if (band->dither) {
+        sixel_dither_unref(band->dither);
+        band->dither = NULL;
+    }
+
+    if (priv->opts.fixedpal) {
+        band->dither = sixel_dither_get(BUILTIN_XTERM256);
+        if (band->dither == NULL)
+            return SIXEL_FALSE;
+    } else {
+        int ncolors = sixel_dither_get_num_of_palette_colors(priv->dither);
+        SIXELSTATUS status = sixel_dither_new(&band->dither, ncolors, NULL);
+        if (SIXEL_FAILED(status))
+            return status;
+        sixel_dither_set_palette(band->dither,
+                                 sixel_dither_get_palette(priv->dither));
+    }
+
+    sixel_dither_set_diffusion_type(band->dither, priv->opts.diffuse);
+    sixel_dither_set_body_only(band->dither, band != &priv->bands[0]);
+    band->palette_gen = priv->palette_gen;
+    return SIXEL_OK;
+}
+
+static void encode_band(struct sixel_band *band)
+{
+    struct priv *priv = band->priv;
+
+    band->buf = talloc_strdup(NULL, "");
+    sixel_encode(priv->buffer + depth * priv->width * band->y, priv->width,
+                 band->h, depth, band->dither, band->output);
+}
+
+static void encode_band_thread(void *ptr)
+{
+    struct sixel_band *band = ptr;
+
+    encode_band(band);
+    mp_waiter_wakeup(&band->waiter, 0);
+}
+
 static inline int sixel_buffer(char *data, int size, void *priv) {
     char **out = (char **)priv;
     *out = talloc_strndup_append_buffer(*out, data, size);
@@ -369,6 +512,8 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
     if (priv->canvas_ok) {  // if too small - succeed but skip the rendering
         set_sixel_output_parameters(vo);
         ret = update_sixel_swscaler(vo, params);
+        if (ret >= 0)
+            setup_bands(vo);
     }
 
     if (priv->opts.config_clear)
@@ -399,7 +544,8 @@ static bool draw_frame(struct vo *vo, struct vo_frame *frame)
         set_sixel_output_parameters(vo);
         // Not checking for vo->config_ok because draw_frame is never called
         // with a failed reconfig.
-        update_sixel_swscaler(vo, vo->params);
+        if (update_sixel_swscaler(vo, vo->params) >= 0)
+            setup_bands(vo);
 
         if (priv->opts.config_clear)
             sixel_strwrite(TERM_ESC_CLEAR_SCREEN);
@@ -476,6 +622,43 @@ static void flip_page(struct vo *vo)
     if (priv->buffer == NULL || priv->dither == NULL)
         return;
 
+    if (priv->num_bands) {
+        for (int n = 0; n < priv->num_bands; n++) {
+            SIXELSTATUS status = update_band_dither(priv, &priv->bands[n]);
+            if (SIXEL_FAILED(status)) {
+                MP_WARN(vo, "flip_page: Failed to create dither: %s\n",
+                        sixel_helper_format_error(status));
+                return;
+            }
+        }
+
+        for (int n = 1; n < priv->num_bands; n++) {
+            struct sixel_band *band = &priv->bands[n];
+            band->waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+            bool r = mp_thread_pool_run(priv->tp, encode_band_thread, band);
+            // There are no more bands than threads, and they're all idle.
+            assert(r);
+        }
+
+        encode_band(&priv->bands[0]);
+
+        for (int n = 1; n < priv->num_bands; n++)
+            mp_waiter_wait(&priv->bands[n].waiter);
+
+        // Write all bands at once, so that they are not interrupted.
+        char *cmd = talloc_strdup(NULL, "");
+        for (int n = 0; n < priv->num_bands; n++) {
+            struct sixel_band *band = &priv->bands[n];
+            cmd = talloc_asprintf_append_buffer(cmd, TERM_ESC_GOTO_YX,
+                        priv->top + band->y / priv->cell_height, priv->left);
+            cmd = talloc_strdup_append_buffer(cmd, band->buf);
+            TA_FREEP(&band->buf);
+        }
+        sixel_write(cmd, strlen(cmd), stdout);
+        talloc_free(cmd);
+        return;
+    }
+
     // Go to the offset row and column, then display the image
     priv->sixel_output_buf = talloc_asprintf(NULL, TERM_ESC_GOTO_YX,
                                              priv->top, priv->left);
@@ -515,6 +698,15 @@ static int preinit(struct vo *vo)
 
     sixel_output_set_encode_policy(priv->output, SIXEL_ENCODEPOLICY_FAST);
 
+    int threads = priv->opts.threads ? priv->opts.threads : av_cpu_count();
+    priv->num_threads = MPCLAMP(threads, 1, 64);
+    if (priv->num_threads > 1) {
+        int n = priv->num_threads - 1;
+        priv->tp = mp_thread_pool_create(vo, n, n, n);
+        if (!priv->tp)
+            priv->num_threads = 1;
+    }
+
     if (priv->opts.alt_screen)
         sixel_strwrite(TERM_ESC_ALT_SCREEN);
 
@@ -595,6 +787,7 @@ const struct vo_driver video_out_sixel = {
         .opts.pad_x = -1,
         .opts.config_clear = true,
         .opts.alt_screen = true,
+        .opts.threads = 1,
     },
     .options = (const m_option_t[]) {
         {"dither", OPT_CHOICE(opts.diffuse,
@@ -621,6 +814,7 @@ const struct vo_driver video_out_sixel = {
         {"config-clear", OPT_BOOL(opts.config_clear), },
         {"alt-screen", OPT_BOOL(opts.alt_screen), },
         {"buffered", OPT_BOOL(opts.buffered), },
+        {"threads", OPT_CHOICE(opts.threads, {"auto", 0}), M_RANGE(1, 64)},
         {0}
     },
     .options_prefix = "vo-sixel",
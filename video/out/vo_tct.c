@@ -24,6 +24,7 @@
 
 #include <libswscale/swscale.h>
 
+#include "common/stats.h"
 #include "options/m_config.h"
 #include "config.h"
 #include "osdep/terminal.h"
@@ -41,6 +42,15 @@
 #define DEFAULT_WIDTH 80
 #define DEFAULT_HEIGHT 25
 
+// With --vo-tct-delta, unchanged cells shorter than this are rewritten instead
+// of moving the cursor over them. A cursor move costs about as many bytes as
+// rewriting this many cells with the same colors.
+#define MIN_SKIP_CELLS 8
+
+// With --vo-tct-delta, redraw the whole image after this many frames, to repair
+// cells overwritten by other terminal output.
+#define FULL_REDRAW_INTERVAL 300
+
 static const bstr TERM_ESC_COLOR256_BG     = bstr0_lit("\033[48;5");
 static const bstr TERM_ESC_COLOR256_FG     = bstr0_lit("\033[38;5");
 static const bstr TERM_ESC_COLOR24BIT_BG   = bstr0_lit("\033[48;2");
@@ -62,6 +72,7 @@ struct vo_tct_opts {
     int width;   // 0 -> default
     int height;  // 0 -> default
     bool term256;  // 0 -> true color
+    bool delta;
 };
 
 struct lut_item {
@@ -80,6 +91,20 @@ struct priv {
     struct mp_sws_context *sws;
     bstr frame_buf;
     struct lut_item lut[256];
+
+    // One entry per terminal cell: background color in the upper 32 bits,
+    // foreground color (half-blocks only) in the lower 32 bits. Colors are
+    // xterm-256 indexes with --vo-tct-256, 0xRRGGBB otherwise.
+    uint64_t *cells;
+    uint64_t *prev_cells;           // what is on the terminal, for delta mode
+    bool full_redraw;               // prev_cells is invalid
+    int delta_frames;               // frames since the last full redraw
+
+    // Colors set on the terminal by the last written cell, or -1.
+    int64_t cur_bg, cur_fg;
+
+    struct stats_ctx *stats;
+    size_t frame_bytes;             // bytes written for the current frame
 };
 
 // Convert RGB24 to xterm-256 8-bit value
@@ -128,77 +153,122 @@ static void print_seq1(bstr *frame, struct lut_item *lut, bstr prefix, uint8_t c
     bstr_xappend0(NULL, frame, "m");
 }
 
-static void print_buffer(bstr *frame)
+static void print_buffer(struct priv *p, bstr *frame)
 {
     fwrite(frame->start, frame->len, 1, stdout);
+    p->frame_bytes += frame->len;
     frame->len = 0;
 }
 
-static void write_plain(bstr *frame,
-    const int dwidth, const int dheight,
-    const int swidth, const int sheight,
-    const unsigned char *source, const int source_stride,
-    bool term256, struct lut_item *lut, enum vo_tct_buffering buffering)
+static void print_color(struct priv *p, bstr *frame, bool fg, uint32_t c)
+{
+    if (p->opts.term256) {
+        print_seq1(frame, p->lut,
+                   fg ? TERM_ESC_COLOR256_FG : TERM_ESC_COLOR256_BG, c);
+    } else {
+        print_seq3(frame, p->lut,
+                   fg ? TERM_ESC_COLOR24BIT_FG : TERM_ESC_COLOR24BIT_BG,
+                   c >> 16, (c >> 8) & 0xFF, c & 0xFF);
+    }
+}
+
+static uint32_t get_color(struct priv *p, const unsigned char *bgr)
 {
+    if (p->opts.term256)
+        return rgb_to_x256(bgr[2], bgr[1], bgr[0]);
+    return (bgr[2] << 16) | (bgr[1] << 8) | bgr[0];
+}
+
+// Convert the scaled frame to the grid of cells written to the terminal.
+static void fill_cells(struct priv *p)
+{
+    bool half_blocks = p->opts.algo == ALGO_HALF_BLOCKS;
+    const unsigned char *source = p->frame->planes[0];
+    const int source_stride = p->frame->stride[0];
     assert(source);
-    const int tx = (dwidth - swidth) / 2;
-    const int ty = (dheight - sheight) / 2;
-    for (int y = 0; y < sheight; y++) {
-        const unsigned char *row = source + y * source_stride;
-        bstr_xappend_asprintf(NULL, frame, TERM_ESC_GOTO_YX, ty + y, tx);
-        for (int x = 0; x < swidth; x++) {
-            unsigned char b = *row++;
-            unsigned char g = *row++;
-            unsigned char r = *row++;
-            if (term256) {
-                print_seq1(frame, lut, TERM_ESC_COLOR256_BG, rgb_to_x256(r, g, b));
-            } else {
-                print_seq3(frame, lut, TERM_ESC_COLOR24BIT_BG, r, g, b);
-            }
-            bstr_xappend0(NULL, frame, " ");
-            if (buffering <= VO_TCT_BUFFER_PIXEL)
-                print_buffer(frame);
+
+    for (int y = 0; y < p->sheight; y++) {
+        const unsigned char *row_up = source + y * (half_blocks + 1) * source_stride;
+        const unsigned char *row_down = row_up + source_stride;
+        uint64_t *cells = &p->cells[y * p->swidth];
+        for (int x = 0; x < p->swidth; x++) {
+            uint64_t bg = get_color(p, row_up + x * 3);
+            uint64_t fg = half_blocks ? get_color(p, row_down + x * 3) : 0;
+            cells[x] = (bg << 32) | fg;
         }
-        bstr_xappend0(NULL, frame, TERM_ESC_CLEAR_COLORS);
-        if (buffering <= VO_TCT_BUFFER_LINE)
-            print_buffer(frame);
     }
 }
 
-static void write_half_blocks(bstr *frame,
-    const int dwidth, const int dheight,
-    const int swidth, const int sheight,
-    unsigned char *source, int source_stride,
-    bool term256, struct lut_item *lut, enum vo_tct_buffering buffering)
+static void write_cell(struct priv *p, bstr *frame, uint64_t cell)
 {
-    assert(source);
-    const int tx = (dwidth - swidth) / 2;
-    const int ty = (dheight - sheight) / 2;
-    for (int y = 0; y < sheight * 2; y += 2) {
-        const unsigned char *row_up = source + y * source_stride;
-        const unsigned char *row_down = source + (y + 1) * source_stride;
-        bstr_xappend_asprintf(NULL, frame, TERM_ESC_GOTO_YX, ty + y / 2, tx);
-        for (int x = 0; x < swidth; x++) {
-            unsigned char b_up = *row_up++;
-            unsigned char g_up = *row_up++;
-            unsigned char r_up = *row_up++;
-            unsigned char b_down = *row_down++;
-            unsigned char g_down = *row_down++;
-            unsigned char r_down = *row_down++;
-            if (term256) {
-                print_seq1(frame, lut, TERM_ESC_COLOR256_BG, rgb_to_x256(r_up, g_up, b_up));
-                print_seq1(frame, lut, TERM_ESC_COLOR256_FG, rgb_to_x256(r_down, g_down, b_down));
-            } else {
-                print_seq3(frame, lut, TERM_ESC_COLOR24BIT_BG, r_up, g_up, b_up);
-                print_seq3(frame, lut, TERM_ESC_COLOR24BIT_FG, r_down, g_down, b_down);
+    bool half_blocks = p->opts.algo == ALGO_HALF_BLOCKS;
+    int64_t bg = cell >> 32;
+    int64_t fg = cell & 0xFFFFFFFF;
+
+    // Runs of the same colors need the color codes only once.
+    if (bg != p->cur_bg)
+        print_color(p, frame, false, bg);
+    if (half_blocks && fg != p->cur_fg)
+        print_color(p, frame, true, fg);
+    p->cur_bg = bg;
+    p->cur_fg = half_blocks ? fg : -1;
+
+    if (half_blocks) {
+        bstr_xappend(NULL, frame, UNICODE_LOWER_HALF_BLOCK);
+    } else {
+        bstr_xappend0(NULL, frame, " ");
+    }
+}
+
+// Return the number of cells starting at x that are already on the terminal.
+static int unchanged_cells(const uint64_t *cells, const uint64_t *prev,
+                           int x, int w)
+{
+    int n = 0;
+    if (prev) {
+        while (x + n < w && cells[x + n] == prev[x + n])
+            n++;
+    }
+    return n;
+}
+
+// Write p->cells to the terminal. If prev is not NULL, it contains what the
+// terminal currently shows, and only changed parts of it are written.
+static void write_cells(struct priv *p, bstr *frame,
+                        const int dwidth, const int dheight,
+                        const uint64_t *prev)
+{
+    const int tx = (dwidth - p->swidth) / 2;
+    const int ty = (dheight - p->sheight) / 2;
+    const int w = p->swidth;
+    for (int y = 0; y < p->sheight; y++) {
+        const uint64_t *cells = &p->cells[y * w];
+        const uint64_t *prev_row = prev ? &prev[y * w] : NULL;
+        bool positioned = false, written = false;
+        p->cur_bg = p->cur_fg = -1;
+        for (int x = 0; x < w;) {
+            int skip = unchanged_cells(cells, prev_row, x, w);
+            if (skip && (!positioned || skip >= MIN_SKIP_CELLS || x + skip == w)) {
+                x += skip;
+                positioned = false;
+                continue;
+            }
+            if (!positioned) {
+                bstr_xappend_asprintf(NULL, frame, TERM_ESC_GOTO_YX,
+                                      ty + y, tx + x);
+                positioned = written = true;
+            }
+            for (int end = x + MPMAX(skip, 1); x < end; x++) {
+                write_cell(p, frame, cells[x]);
+                if (p->opts.buffering <= VO_TCT_BUFFER_PIXEL)
+                    print_buffer(p, frame);
             }
-            bstr_xappend(NULL, frame, UNICODE_LOWER_HALF_BLOCK);
-            if (buffering <= VO_TCT_BUFFER_PIXEL)
-                print_buffer(frame);
         }
-        bstr_xappend0(NULL, frame, TERM_ESC_CLEAR_COLORS);
-        if (buffering <= VO_TCT_BUFFER_LINE)
-            print_buffer(frame);
+        if (written) {
+            bstr_xappend0(NULL, frame, TERM_ESC_CLEAR_COLORS);
+            if (p->opts.buffering <= VO_TCT_BUFFER_LINE)
+                print_buffer(p, frame);
+        }
     }
 }
 
@@ -244,6 +314,11 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
 
     mp_image_clear(p->frame, 0, 0, p->frame->w, p->frame->h);
 
+    size_t num_cells = (size_t)p->swidth * p->sheight;
+    p->cells = talloc_realloc(p, p->cells, uint64_t, num_cells);
+    p->prev_cells = talloc_realloc(p, p->prev_cells, uint64_t, num_cells);
+    p->full_redraw = true;
+
     if (mp_sws_reinit(p->sws) < 0)
         return -1;
 
@@ -259,6 +334,10 @@ static bool draw_frame(struct vo *vo, struct vo_frame *frame)
     struct mp_image *src = frame->current;
     if (!src)
         goto done;
+    // Redraws of the same frame (e.g. OSD changes while paused) are cheap
+    // enough to repair the whole image.
+    if (frame->redraw)
+        p->full_redraw = true;
     // XXX: pan, crop etc.
     mp_sws_scale(p->sws, p->frame, src);
 
@@ -278,25 +357,30 @@ static void flip_page(struct vo *vo)
 
     WRITE_STR(TERM_ESC_SYNC_UPDATE_BEGIN);
 
+    fill_cells(p);
+
+    if (++p->delta_frames >= FULL_REDRAW_INTERVAL)
+        p->full_redraw = true;
+    if (p->full_redraw)
+        p->delta_frames = 0;
+
+    bool delta = p->opts.delta && !p->full_redraw;
     p->frame_buf.len = 0;
-    if (p->opts.algo == ALGO_PLAIN) {
-        write_plain(&p->frame_buf,
-            vo->dwidth, vo->dheight, p->swidth, p->sheight,
-            p->frame->planes[0], p->frame->stride[0],
-            p->opts.term256, p->lut, p->opts.buffering);
-    } else {
-        write_half_blocks(&p->frame_buf,
-            vo->dwidth, vo->dheight, p->swidth, p->sheight,
-            p->frame->planes[0], p->frame->stride[0],
-            p->opts.term256, p->lut, p->opts.buffering);
-    }
+    p->frame_bytes = 0;
+    write_cells(p, &p->frame_buf, vo->dwidth, vo->dheight,
+                delta ? p->prev_cells : NULL);
 
     bstr_xappend0(NULL, &p->frame_buf, "\n");
     if (p->opts.buffering <= VO_TCT_BUFFER_FRAME)
-        print_buffer(&p->frame_buf);
+        print_buffer(p, &p->frame_buf);
 
     WRITE_STR(TERM_ESC_SYNC_UPDATE_END);
     fflush(stdout);
+
+    MPSWAP(uint64_t *, p->cells, p->prev_cells);
+    p->full_redraw = false;
+
+    stats_size_value(p->stats, "frame-bytes", p->frame_bytes);
 }
 
 static void uninit(struct vo *vo)
@@ -319,6 +403,7 @@ static int preinit(struct vo *vo)
     p->sws = mp_sws_alloc(vo);
     p->sws->log = vo->log;
     mp_sws_enable_cmdline_opts(p->sws, vo->global);
+    p->stats = stats_ctx_create(p, vo->global, "vo-tct");
 
     for (int i = 0; i < MP_ARRAY_SIZE(p->lut); ++i) {
         char* out = p->lut[i].str;
@@ -345,6 +430,17 @@ static int query_format(struct vo *vo, int format)
 
 static int control(struct vo *vo, uint32_t request, void *data)
 {
+    struct priv *p = vo->priv;
+
+    switch (request) {
+    case VOCTRL_SET_PANSCAN:
+        return (vo->config_ok && !reconfig(vo, vo->params)) ? VO_TRUE : VO_FALSE;
+    case VOCTRL_RESET:
+    case VOCTRL_RESUME:
+        // Terminal output while paused or seeking may have damaged the image.
+        p->full_redraw = true;
+        return VO_TRUE;
+    }
     return VO_NOTIMPL;
 }
 
@@ -372,6 +468,7 @@ const struct vo_driver video_out_tct = {
         {"width", OPT_INT(opts.width)},
         {"height", OPT_INT(opts.height)},
         {"256", OPT_BOOL(opts.term256)},
+        {"delta", OPT_BOOL(opts.delta)},
         {"buffering", OPT_CHOICE(opts.buffering,
             {"pixel", VO_TCT_BUFFER_PIXEL},
             {"line", VO_TCT_BUFFER_LINE},
@@ -31,6 +31,7 @@ enum repack_step_type {
     REPACK_STEP_FLOAT,
     REPACK_STEP_REPACK,
     REPACK_STEP_ENDIAN,
+    REPACK_STEP_NV_FLOAT,       // REPACK_STEP_REPACK+FLOAT for NV formats
 };
 
 struct repack_step {
@@ -793,12 +794,18 @@ static void setup_nv_packer(struct mp_repack *rp)
     }
 }
 
+// Round to nearest integer in [0, p_max], with halfway cases rounded up. Unlike
+// lrint(), this can be inlined and vectorized by the compiler. The comparison
+// is written so that NaN becomes 0, as converting NaN to an integer is UB.
+#define F32_TO_INT(v, p_max) \
+    (!((v) > 0.0f) ? 0.0f : MPMIN((v), (float)(p_max)) + 0.5f)
+
 #define PA_F32(name, packed_t)                                              \
     static void name(void *restrict dst, float *restrict src, int w, float m, \
                      float o, uint32_t p_max) {                             \
         for (int x = 0; x < w; x++) {                                       \
             ((packed_t *)dst)[x] =                                          \
-                MPCLAMP(lrint((src[x] + o) * m), 0, (packed_t)p_max);       \
+                (packed_t)F32_TO_INT((src[x] + o) * m, p_max);              \
         }                                                                   \
     }
 
@@ -837,6 +844,70 @@ static void repack_float(struct mp_repack *rp,
     }
 }
 
+#define PA_NV_F32(name, comp_t)                                             \
+    static void name(void *restrict dst, float *restrict src0,              \
+                     float *restrict src1, int w, const float *m,           \
+                     const float *o, uint32_t p_max) {                      \
+        for (int x = 0; x < w; x++) {                                       \
+            ((comp_t *)dst)[x * 2 + 0] =                                    \
+                (comp_t)F32_TO_INT((src0[x] + o[0]) * m[0], p_max);         \
+            ((comp_t *)dst)[x * 2 + 1] =                                    \
+                (comp_t)F32_TO_INT((src1[x] + o[1]) * m[1], p_max);         \
+        }                                                                   \
+    }
+
+#define UN_NV_F32(name, comp_t)                                             \
+    static void name(void *restrict src, float *restrict dst0,              \
+                     float *restrict dst1, int w, const float *m,           \
+                     const float *o, uint32_t unused) {                     \
+        for (int x = 0; x < w; x++) {                                       \
+            dst0[x] = ((comp_t *)src)[x * 2 + 0] * m[0] + o[0];             \
+            dst1[x] = ((comp_t *)src)[x * 2 + 1] * m[1] + o[1];             \
+        }                                                                   \
+    }
+
+PA_NV_F32(pa_nv_f32_8, uint8_t)
+UN_NV_F32(un_nv_f32_8, uint8_t)
+PA_NV_F32(pa_nv_f32_16, uint16_t)
+UN_NV_F32(un_nv_f32_16, uint16_t)
+
+// Like repack_nv() followed by repack_float(), without the temporary planar
+// integer buffer. a is the NV image, b the planar float image.
+static void repack_nv_float(struct mp_repack *rp,
+                            struct mp_image *a, int a_x, int a_y,
+                            struct mp_image *b, int b_x, int b_y, int w)
+{
+    assert(rp->f32_comp_size == 1 || rp->f32_comp_size == 2);
+
+    void (*packer)(void *restrict a, float *restrict b, int w, float fm, float fb, uint32_t max)
+        = rp->pack ? (rp->f32_comp_size == 1 ? pa_f32_8 : pa_f32_16)
+                   : (rp->f32_comp_size == 1 ? un_f32_8 : un_f32_16);
+
+    int h = (1 << b->fmt.chroma_ys) - (1 << b->fmt.ys[0]) + 1;
+    for (int y = 0; y < h; y++) {
+        void *pa = mp_image_pixel_ptr_ny(a, 0, a_x, a_y + y);
+        void *pb = mp_image_pixel_ptr_ny(b, 0, b_x, b_y + y);
+
+        packer(pa, pb, w, rp->f32_m[0], rp->f32_o[0], rp->f32_pmax[0]);
+    }
+
+    void (*nv_packer)(void *restrict a, float *restrict b0, float *restrict b1,
+                      int w, const float *fm, const float *fb, uint32_t max)
+        = rp->pack ? (rp->f32_comp_size == 1 ? pa_nv_f32_8 : pa_nv_f32_16)
+                   : (rp->f32_comp_size == 1 ? un_nv_f32_8 : un_nv_f32_16);
+
+    int c0 = rp->components[0];
+    int c1 = rp->components[1];
+    int xs = a->fmt.chroma_xs;
+    void *pa = mp_image_pixel_ptr(a, 1, a_x, a_y);
+    float *pb0 = mp_image_pixel_ptr(b, c0, b_x, b_y);
+    float *pb1 = mp_image_pixel_ptr(b, c1, b_x, b_y);
+    float m[2] = {rp->f32_m[c0], rp->f32_m[c1]};
+    float o[2] = {rp->f32_o[c0], rp->f32_o[c1]};
+
+    nv_packer(pa, pb0, pb1, (w + (1 << xs) - 1) >> xs, m, o, rp->f32_pmax[c0]);
+}
+
 static void update_repack_float(struct mp_repack *rp)
 {
     if (!rp->f32_comp_size)
@@ -923,6 +994,9 @@ void repack_line(struct mp_repack *rp, int dst_x, int dst_y,
         case REPACK_STEP_FLOAT:
             repack_float(rp, buf_a, a_x, a_y, buf_b, b_x, b_y, w);
             break;
+        case REPACK_STEP_NV_FLOAT:
+            repack_nv_float(rp, buf_a, a_x, a_y, buf_b, b_x, b_y, w);
+            break;
         }
     }
 }
@@ -1006,6 +1080,17 @@ static bool setup_format_ne(struct mp_repack *rp)
         .fmt = { rp->fmt_b, rp->fmt_a },
     };
 
+    // Merge NV repacking and float conversion into a single step. (Used for
+    // NV12/P010 video in draw_bmp.)
+    if (rp->f32_comp_size && rp->repack == repack_nv && !rp->endian_size) {
+        assert(rp->num_steps == 2);
+        rp->steps[0] = (struct repack_step) {
+            .type = REPACK_STEP_NV_FLOAT,
+            .fmt = { rp->steps[0].fmt[0], rp->fmt_a },
+        };
+        rp->num_steps = 1;
+    }
+
     if (rp->endian_size) {
         rp->steps[rp->num_steps++] = (struct repack_step) {
             .type = REPACK_STEP_ENDIAN,
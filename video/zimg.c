@@ -22,9 +22,11 @@
 #include "common/common.h"
 #include "common/msg.h"
 #include "csputils.h"
+#include "common/stats.h"
 #include "misc/thread_pool.h"
 #include "misc/thread_tools.h"
 #include "options/m_config.h"
+#include "osdep/threads.h"
 #include "options/m_option.h"
 #include "repack.h"
 #include "video/fmt-conversion.h"
@@ -32,6 +34,10 @@
 #include "zimg.h"
 #include "config.h"
 
+#if HAVE_POSIX
+#include <unistd.h>
+#endif
+
 static_assert(MP_IMAGE_BYTE_ALIGN >= ZIMG_ALIGN, "");
 
 #define HAVE_ZIMG_ALPHA (ZIMG_API_VERSION >= ZIMG_MAKE_API_VERSION(2, 4))
@@ -87,9 +93,56 @@ struct mp_zimg_state {
     struct mp_zimg_repack *dst;
     int slice_y, slice_h; // y start position, height of target slice
     double scale_y;
-    struct mp_waiter thread_waiter;
 };
 
+struct mp_zimg_worker {
+    struct mp_zimg_context *ctx;
+    struct mp_waiter waiter;
+};
+
+// Worker threads shared by all mp_zimg_contexts. The pool is created when the
+// first context needs it, and destroyed when the last one is freed.
+#define MAX_THREADS 64
+static mp_static_mutex pool_lock = MP_STATIC_MUTEX_INITIALIZER;
+static struct mp_thread_pool *pool;
+static int pool_refs;
+
+static struct mp_thread_pool *pool_acquire(void)
+{
+    mp_mutex_lock(&pool_lock);
+    if (!pool) {
+        // Threads are created on demand, but are kept afterwards.
+        pool = mp_thread_pool_create(NULL, 0, MAX_THREADS, MAX_THREADS);
+    }
+    if (pool)
+        pool_refs++;
+    struct mp_thread_pool *res = pool;
+    mp_mutex_unlock(&pool_lock);
+    return res;
+}
+
+static void pool_release(struct mp_thread_pool *tp)
+{
+    if (!tp)
+        return;
+    mp_mutex_lock(&pool_lock);
+    assert(tp == pool && pool_refs > 0);
+    pool_refs--;
+    if (!pool_refs)
+        TA_FREEP(&pool);
+    mp_mutex_unlock(&pool_lock);
+}
+
+// Size of the per-core cache a slice should fit in.
+static int get_slice_cache_size(void)
+{
+    long size = 0;
+#if HAVE_POSIX && defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return size > 0 ? MPMIN(size, 64 * 1024 * 1024) : 1024 * 1024;
+}
+
 struct mp_zimg_repack {
     bool pack;                  // if false, this is for unpacking
     struct mp_image_params fmt; // original mp format (possibly packed format,
@@ -216,7 +269,7 @@ static void free_mp_zimg(void *p)
     struct mp_zimg_context *ctx = p;
 
     destroy_zimg(ctx);
-    TA_FREEP(&ctx->tp);
+    pool_release(ctx->tp);
 }
 
 struct mp_zimg_context *mp_zimg_alloc(void)
@@ -237,6 +290,7 @@ void mp_zimg_enable_cmdline_opts(struct mp_zimg_context *ctx,
         return;
 
     ctx->opts_cache = m_config_cache_alloc(ctx, g, &zimg_conf);
+    ctx->stats = stats_ctx_create(ctx, g, "zimg");
     destroy_zimg(ctx); // force update
     mp_zimg_update_from_cmdline(ctx); // first update
 }
@@ -586,33 +640,53 @@ bool mp_zimg_config(struct mp_zimg_context *ctx)
     if (ctx->opts_cache)
         mp_zimg_update_from_cmdline(ctx);
 
-    int slices = ctx->opts.threads;
-    if (slices < 1)
-        slices = av_cpu_count();
-    slices = MPCLAMP(slices, 1, 64);
+    if (ctx->stats)
+        stats_time_start(ctx->stats, "config");
+
+    int threads = ctx->opts.threads;
+    if (threads < 1)
+        threads = av_cpu_count();
+    threads = MPCLAMP(threads, 1, MAX_THREADS);
 
     struct mp_imgfmt_desc dstfmt = mp_imgfmt_get_desc(ctx->dst.imgfmt);
-    if (!dstfmt.align_y)
+    if (!dstfmt.align_y || ctx->dst.h < 1)
         goto fail;
     int full_h = MP_ALIGN_UP(ctx->dst.h, dstfmt.align_y);
+
+    // Size the slices so that the source and destination data touched by a
+    // slice fits into the cache. There are more slices than threads on large
+    // images; threads pick up the next unprocessed slice when they're done.
+    // Small images may use fewer threads than requested.
+    int64_t line_bytes =
+        (mp_image_get_alloc_size(ctx->src.imgfmt, ctx->src.w, ctx->src.h, 1) +
+         mp_image_get_alloc_size(ctx->dst.imgfmt, ctx->dst.w, ctx->dst.h, 1)) /
+        ctx->dst.h;
+    int slices = 1;
+    if (threads > 1 && line_bytes > 0) {
+        int64_t cache_h = get_slice_cache_size() / line_bytes;
+        slices = MPCLAMP((full_h + cache_h - 1) / MPMAX(cache_h, 1), 1,
+                         threads * 4);
+    }
     int slice_h = (full_h + slices - 1) / slices;
     slice_h = MP_ALIGN_UP(slice_h, dstfmt.align_y);
     slice_h = MP_ALIGN_UP(slice_h, 64); // for dithering and minimum slice size
     slices = (full_h + slice_h - 1) / slice_h;
 
-    int threads = slices - 1;
-    if (threads != ctx->current_thread_count) {
-        // Just destroy and recreate all - dumb and costly, but rarely happens.
-        TA_FREEP(&ctx->tp);
-        ctx->current_thread_count = 0;
-        if (threads) {
-            MP_VERBOSE(ctx, "using %d threads for scaling\n", threads);
-            ctx->tp = mp_thread_pool_create(NULL, threads, threads, threads);
-            if (!ctx->tp)
-                goto fail;
-            ctx->current_thread_count = threads;
-        }
+    int workers = MPMIN(threads, slices) - 1;
+    if (workers && !ctx->tp) {
+        ctx->tp = pool_acquire();
+        if (!ctx->tp)
+            goto fail;
     }
+    if (workers != ctx->num_workers) {
+        MP_VERBOSE(ctx, "using %d threads and %d slices for scaling\n",
+                   workers + 1, slices);
+    }
+    ctx->workers = talloc_realloc(ctx, ctx->workers, struct mp_zimg_worker,
+                                  workers);
+    ctx->num_workers = workers;
+    for (int n = 0; n < workers; n++)
+        ctx->workers[n] = (struct mp_zimg_worker){ .ctx = ctx };
 
     for (int n = 0; n < slices; n++) {
         struct mp_zimg_state *st = talloc_zero(NULL, struct mp_zimg_state);
@@ -624,9 +698,17 @@ bool mp_zimg_config(struct mp_zimg_context *ctx)
 
     assert(ctx->num_states == slices);
 
+    if (ctx->stats) {
+        stats_time_end(ctx->stats, "config");
+        stats_value(ctx->stats, "slices", slices);
+        stats_value(ctx->stats, "threads", workers + 1);
+    }
+
     return true;
 
 fail:
+    if (ctx->stats)
+        stats_time_end(ctx->stats, "config");
     destroy_zimg(ctx);
     return false;
 }
@@ -665,12 +747,23 @@ static void do_convert(struct mp_zimg_state *st)
                               repack_entrypoint, st->dst);
 }
 
+// Convert slices until none are left.
+static void do_convert_slices(struct mp_zimg_context *ctx)
+{
+    while (1) {
+        int n = atomic_fetch_add(&ctx->next_slice, 1);
+        if (n >= ctx->num_states)
+            break;
+        do_convert(ctx->states[n]);
+    }
+}
+
 static void do_convert_thread(void *ptr)
 {
-    struct mp_zimg_state *st = ptr;
+    struct mp_zimg_worker *w = ptr;
 
-    do_convert(st);
-    mp_waiter_wakeup(&st->thread_waiter, 0);
+    do_convert_slices(w->ctx);
+    mp_waiter_wakeup(&w->waiter, 0);
 }
 
 bool mp_zimg_convert(struct mp_zimg_context *ctx, struct mp_image *dst,
@@ -693,22 +786,37 @@ bool mp_zimg_convert(struct mp_zimg_context *ctx, struct mp_image *dst,
         }
     }
 
-    for (int n = 1; n < ctx->num_states; n++) {
-        struct mp_zimg_state *st = ctx->states[n];
+    if (ctx->stats)
+        stats_time_start(ctx->stats, "convert");
 
-        st->thread_waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+    atomic_store(&ctx->next_slice, 0);
 
-        bool r = mp_thread_pool_run(ctx->tp, do_convert_thread, st);
-        // This is guaranteed by the API; and unrolling would be inconvenient.
-        assert(r);
+    int workers = 0;
+    for (; workers < ctx->num_workers; workers++) {
+        struct mp_zimg_worker *w = &ctx->workers[workers];
+
+        w->waiter = (struct mp_waiter)MP_WAITER_INITIALIZER;
+
+        // The pool is shared with other conversions and may be exhausted. In
+        // this case, the remaining slices are converted by fewer threads,
+        // instead of waiting for a thread to become free.
+        if (!mp_thread_pool_try_run(ctx->tp, do_convert_thread, w))
+            break;
     }
 
-    do_convert(ctx->states[0]);
+    do_convert_slices(ctx);
 
-    for (int n = 1; n < ctx->num_states; n++) {
-        struct mp_zimg_state *st = ctx->states[n];
+    // Time spent waiting for the other threads to finish their last slice.
+    if (ctx->stats)
+        stats_time_start(ctx->stats, "wait");
+
+    for (int n = 0; n < workers; n++)
+        mp_waiter_wait(&ctx->workers[n].waiter);
 
-        mp_waiter_wait(&st->thread_waiter);
+    if (ctx->stats) {
+        stats_time_end(ctx->stats, "wait");
+        stats_time_end(ctx->stats, "convert");
+        stats_value(ctx->stats, "active-threads", workers + 1);
     }
 
     return true;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
 
 #include <zimg.h>
@@ -43,8 +44,11 @@ struct mp_zimg_context {
     struct m_config_cache *opts_cache;
     struct mp_zimg_state **states;
     int num_states;
+    struct mp_zimg_worker *workers;
+    int num_workers;
+    atomic_int next_slice;
     struct mp_thread_pool *tp;
-    int current_thread_count;
+    struct stats_ctx *stats;
 };
 
 // Allocate a zimg context. Always succeeds. Returns a talloc pointer (use